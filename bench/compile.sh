@@ -0,0 +1,51 @@
+#!/bin/sh
+# Times the compiler alone on a generated script with FUNCS functions, each
+# with a few locals, a global of its own and a call to the function before
+# it, so that every kind of name lookup gets a large table to search. The
+# best wall clock time out of RUNS runs is printed, the bytecode cache is
+# bypassed.
+#
+# usage: bench/compile.sh [FUNCS] [RUNS]
+
+FUNCS=${1:-10000}
+RUNS=${2:-5}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$ROOT/_bench_build}
+NCC=${NCC:-$BUILD/threaded/ncc}
+
+if [ ! -x "$NCC" ]; then
+    cmake -S "$ROOT" -B "$BUILD/threaded" -DCMAKE_BUILD_TYPE=Release > /dev/null || exit 1
+    cmake --build "$BUILD/threaded" -j > /dev/null || exit 1
+fi
+
+script=$(mktemp "${TMPDIR:-/tmp}/ncc_compile_XXXXXX")
+mv "$script" "$script.nc"
+script=$script.nc
+trap 'rm -f "$script" "${script}b"' EXIT
+
+awk -v n="$FUNCS" 'BEGIN {
+    print "func f0(a) {\n    return a;\n}\n"
+    for (i = 1; i < n; ++i) {
+        printf "var g%d = %d;\n\n", i, i
+        printf "func f%d(a) {\n", i
+        printf "    var x = a + g%d;\n", i
+        printf "    var y = x * 2;\n"
+        printf "    if (y > 10) {\n        var x = y - 1;\n        y = x;\n    }\n"
+        printf "    return f%d(y) + x;\n}\n\n", i - 1
+    }
+    printf "func main() {\n    print(\"{f%d(1)}\\n\");\n}\n", n - 1
+}' > "$script"
+
+best=""
+i=0
+while [ $i -lt "$RUNS" ]; do
+    start=$(date +%s%N)
+    "$NCC" "$script" --no-cache > /dev/null 2>&1
+    elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+    if [ -z "$best" ] || [ $elapsed -lt $best ]; then
+        best=$elapsed
+    fi
+    i=$((i + 1))
+done
+
+echo "$FUNCS functions: ${best}ms"
@@ -0,0 +1,11 @@
+func fib(n) {
+    if (n < 2) {
+        return n;
+    }
+
+    return fib(n - 1) + fib(n - 2);
+}
+
+func main() {
+    print("30th fibonacci is: {fib(30)}\n");
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Times the compiler on a generated script of about MB megabytes made of
+# small functions full of keywords, names and numbers, which mostly puts the
+# lexer to work. The best wall clock time out of RUNS runs is printed, the
+# bytecode cache is bypassed.
+#
+# usage: bench/lex.sh [MB] [RUNS]
+
+MB=${1:-8}
+RUNS=${2:-5}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$ROOT/_bench_build}
+NCC=${NCC:-$BUILD/threaded/ncc}
+
+if [ ! -x "$NCC" ]; then
+    cmake -S "$ROOT" -B "$BUILD/threaded" -DCMAKE_BUILD_TYPE=Release > /dev/null || exit 1
+    cmake --build "$BUILD/threaded" -j > /dev/null || exit 1
+fi
+
+script=$(mktemp "${TMPDIR:-/tmp}/ncc_lex_XXXXXX")
+mv "$script" "$script.nc"
+script=$script.nc
+trap 'rm -f "$script" "${script}b"' EXIT
+
+# every function is about 500 bytes
+awk -v n="$((MB * 2000))" 'BEGIN {
+    for (i = 0; i < n; ++i) {
+        printf "func function_%d(first_argument, second_argument) {\n", i
+        printf "    var counter_value = first_argument * 12345 + second_argument;\n"
+        printf "    var another_value = 0;\n"
+        printf "    for (var index = 0; index < 100; index = index + 1) {\n"
+        printf "        if (counter_value > 1000 && index != 7) {\n"
+        printf "            another_value = another_value + counter_value %% 97;\n"
+        printf "        } elif (counter_value == 3) {\n"
+        printf "            another_value = another_value - 1;\n"
+        printf "        } else {\n"
+        printf "            another_value = 2.5;\n"
+        printf "        }\n"
+        printf "    }\n"
+        printf "    return another_value;\n"
+        printf "}\n\n"
+    }
+    printf "func main() {\n    print(\"done\\n\");\n}\n"
+}' > "$script"
+
+best=""
+i=0
+while [ $i -lt "$RUNS" ]; do
+    start=$(date +%s%N)
+    "$NCC" "$script" --no-cache > /dev/null 2>&1
+    elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+    if [ -z "$best" ] || [ $elapsed -lt $best ]; then
+        best=$elapsed
+    fi
+    i=$((i + 1))
+done
+
+echo "$(( $(wc -c < "$script") / 1024 ))KB: ${best}ms"
@@ -0,0 +1,11 @@
+func sum(n) {
+    var s = 0;
+    for (var i = 0; i < n; ++i) {
+        s = s + i;
+    }
+    return s;
+}
+
+func main() {
+    print("sum is: {sum(3000000)}\n");
+}
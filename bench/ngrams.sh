@@ -0,0 +1,34 @@
+#!/bin/sh
+# Runs every script with --ngrams and adds up how often each sequence of
+# 2 to 4 neighbouring instructions ran, to pick the sequences that are worth
+# a superinstruction. Scripts default to bench/*.nc.
+#
+# usage: bench/ngrams.sh [-n TOP] [SCRIPT...]
+
+TOP=30
+if [ "$1" = "-n" ]; then
+    TOP=$2
+    shift 2
+fi
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$ROOT/_bench_build}
+NCC=${NCC:-$BUILD/threaded/ncc}
+
+if [ ! -x "$NCC" ]; then
+    cmake -S "$ROOT" -B "$BUILD/threaded" -DCMAKE_BUILD_TYPE=Release > /dev/null || exit 1
+    cmake --build "$BUILD/threaded" -j > /dev/null || exit 1
+fi
+
+if [ $# -eq 0 ]; then
+    set -- "$ROOT"/bench/*.nc
+fi
+
+for script in "$@"; do
+    "$NCC" "$script" --ngrams < /dev/null 2>&1 > /dev/null | grep '^[0-9]'
+done | awk -F '\t' '
+    { counts[$2] += $1; total[split($2, ops, " ")] += $1 }
+    END {
+        for (ngram in counts)
+            printf "%d\t%5.1f%%\t%s\n", counts[ngram], 100 * counts[ngram] / total[split(ngram, ops, " ")], ngram
+    }' | sort -t "$(printf '\t')" -k1,1nr | head -n "$TOP"
@@ -0,0 +1,87 @@
+#!/bin/sh
+# Builds ncc once for every configuration below and runs each bench/*.nc
+# script with it, printing the best wall clock time out of RUNS runs.
+# When GNU time is installed, the peak memory of each run is printed too.
+#
+# usage: bench/run.sh [RUNS]
+
+RUNS=${1:-5}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$ROOT/_bench_build}
+
+# name:cmake flags[:ncc flags] (flags are separated by ',')
+CONFIGS="
+switch:-DNCC_THREADED_DISPATCH=OFF
+threaded:-DNCC_THREADED_DISPATCH=ON
+unfused:-DNCC_THREADED_DISPATCH=ON:--no-fuse
+nanbox:-DNCC_THREADED_DISPATCH=ON,-DNCC_NAN_BOXING=ON
+jit:-DNCC_THREADED_DISPATCH=ON:--jit
+register:-DNCC_THREADED_DISPATCH=ON,-DNCC_REGISTER_VM=ON
+"
+
+now() {
+    date +%s%N
+}
+
+cmake_flags() {
+    rest=${1#*:}
+    echo "${rest%%:*}" | tr ',' ' '
+}
+
+ncc_flags() {
+    rest=${1#*:}
+    case $rest in
+        *:*) echo "${rest#*:}" | tr ',' ' ' ;;
+    esac
+}
+
+for config in $CONFIGS; do
+    name=${config%%:*}
+    flags=$(cmake_flags "$config")
+    cmake -S "$ROOT" -B "$BUILD/$name" -DCMAKE_BUILD_TYPE=Release $flags > /dev/null || exit 1
+    cmake --build "$BUILD/$name" -j > /dev/null || exit 1
+done
+
+header() {
+    printf "%-16s" "$1"
+    for config in $CONFIGS; do
+        printf "%12s" "${config%%:*}"
+    done
+    printf "\n"
+}
+
+header "time"
+
+for script in "$ROOT"/bench/*.nc; do
+    printf "%-16s" "$(basename "$script" .nc)"
+    for config in $CONFIGS; do
+        name=${config%%:*}
+        best=""
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            start=$(now)
+            "$BUILD/$name/ncc" "$script" $(ncc_flags "$config") > /dev/null
+            elapsed=$(( ($(now) - start) / 1000000 ))
+            if [ -z "$best" ] || [ $elapsed -lt $best ]; then
+                best=$elapsed
+            fi
+            i=$((i + 1))
+        done
+        printf "%10dms" "$best"
+    done
+    printf "\n"
+done
+
+if [ -x /usr/bin/time ]; then
+    printf "\n"
+    header "peak memory"
+    for script in "$ROOT"/bench/*.nc; do
+        printf "%-16s" "$(basename "$script" .nc)"
+        for config in $CONFIGS; do
+            name=${config%%:*}
+            kb=$(/usr/bin/time -f "%M" "$BUILD/$name/ncc" "$script" $(ncc_flags "$config") 2>&1 > /dev/null | tail -n 1)
+            printf "%10dKB" "$kb"
+        done
+        printf "\n"
+    done
+fi
@@ -48,11 +48,69 @@ void resetConsole(void) {
 #include <vector>
 #include <array>
 #include <unordered_map>
+#include <unordered_set>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <cstring>
 #include <cmath>
 #include <chrono>
 #include <algorithm>
+#include <type_traits>
+
+/* the lexer skips blanks, comments and string contents 16 bytes at a time
+ * with sse2 when the compiler targets it, otherwise a byte at a time */
+#ifndef NCC_SIMD_LEXER
+#if defined(__SSE2__)
+#define NCC_SIMD_LEXER 1
+#else
+#define NCC_SIMD_LEXER 0
+#endif
+#endif
+
+#if NCC_SIMD_LEXER
+#include <emmintrin.h>
+#endif
+
+/* values are 24 byte tagged unions unless nan boxing is turned on */
+#ifndef NCC_NAN_BOXING
+#define NCC_NAN_BOXING 0
+#endif
+
+/* functions run as stack code unless this is on, then registerize()
+ * rewrites them into three address code over frame registers */
+#ifndef NCC_REGISTER_VM
+#define NCC_REGISTER_VM 0
+#endif
+
+/* the jit writes x86-64 code for the tagged union Value layout and only
+ * knows the stack form of the instructions */
+#ifndef NCC_JIT
+#if defined(__linux) && defined(__x86_64__) && !NCC_NAN_BOXING && !NCC_REGISTER_VM
+#define NCC_JIT 1
+#else
+#define NCC_JIT 0
+#endif
+#endif
+
+/* the source and the bytecode cache are mapped in on linux, the jit needs
+ * it for its code */
+#ifdef __linux
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* computed goto (labels as values) is a GNU extension, every other compiler
+ * gets the plain switch based dispatch in run_vm() */
+#ifndef NCC_THREADED_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+#define NCC_THREADED_DISPATCH 1
+#else
+#define NCC_THREADED_DISPATCH 0
+#endif
+#endif
 
 /* ---------------- aliases ----------------- */
 using u8_t = std::uint8_t;
@@ -152,11 +210,12 @@ struct Token {
     i32_t line;
 };
 
-enum OpCode {
+enum OpCode : u8_t {
     int_c,  /* integer constant */
     char_c,     /* character constant */
     double_c,   /* double constant */
     string_c,
+    int_i,      /* integer that fits in the operand itself */
     add,
     sub,
     mult,
@@ -186,12 +245,8 @@ enum OpCode {
     jif,    /* jump if false */
     jump,
     ipop,
-    ipush_bp,
-    ipop_bp,
-    push_arg_addr,
-    pop_arg_addr,
-    set_arg_addr,
-    ret_addr,
+    enter,      /* operand is the frame size, see size_frames() */
+    call,       /* operand is the function, count its number of arguments */
     print,
     local_get_c,
     local_get_i,
@@ -246,15 +301,75 @@ enum OpCode {
     get_arg_array_ref,
     set_arg_array_ref,
 
-    store_ret_value,
-    load_ret_value,
-
     cast_to_int,
     cast_to_double,
     cast_to_char,
     cast_to_bool,
 
-    ret,
+    /* quickened forms, run_vm rewrites the generic instruction into one of
+     * these after it has seen the kinds of its operands. never emitted */
+    add_int_int,
+    sub_int_int,
+    mult_int_int,
+    idiv_int_int,
+    mod_int_int,
+    lt_int_int,
+    lte_int_int,
+    gt_int_int,
+    gte_int_int,
+    eq_int_int,
+    neq_int_int,
+    add_double_double,
+    sub_double_double,
+    mult_double_double,
+    idiv_double_double,
+    lt_double_double,
+    lte_double_double,
+    gt_double_double,
+    gte_double_double,
+
+    /* superinstructions, written by fuse() over the first instruction of
+     * the sequence they stand for. the rest of the sequence stays in place */
+    jif_local_lt_const,     /* get_local, int_c, lt, jif, ipop */
+    jif_local_lte_const,
+    jif_local_gt_const,
+    jif_local_gte_const,
+    jif_local_lt_local,     /* get_local, get_local, lt, jif, ipop */
+    jif_local_lte_local,
+    jif_local_gt_local,
+    jif_local_gte_local,
+    add_local_const,    /* get_local, int_c, add, set_local, ipop */
+    add_local_local,    /* get_local, get_local, add, set_local, ipop */
+    inc_local_discard,  /* pre_inc_local, ipop */
+    dec_local_discard,  /* pre_dec_local, ipop */
+    pop_jump,           /* ipop, jump */
+
+    jit_call,   /* call into jit compiled code, never emitted either */
+
+    /* register forms, written by registerize() when NCC_REGISTER_VM is on.
+     * operand is the destination register (or the jump target), src1 and
+     * src2 are registers, or constants when count & 1 or count & 2 is set */
+    move_r,
+    add_r,
+    sub_r,
+    mult_r,
+    idiv_r,
+    mod_r,
+    lt_r,
+    lte_r,
+    gt_r,
+    gte_r,
+    eq_r,
+    neq_r,
+    jit_r,
+    jif_r,
+    inc_r,
+    dec_r,
+    call_r,     /* call with sp set first, src1 is the stack depth of the caller */
+    ret_r,      /* ret of the value in src1 */
+    set_sp,     /* sp = bp + operand, before an instruction that uses the stack */
+
+    ret,        /* returns the value on top to the caller of the frame */
     main_ret
 };
 
@@ -263,6 +378,7 @@ constexpr char const *instructions[] = {
     "char_c",
     "double_c",
     "string_c",
+    "int_i",
     "add",
     "sub",
     "mult",
@@ -292,12 +408,8 @@ constexpr char const *instructions[] = {
     "jif",
     "jump",
     "ipop",
-    "ipush_bp",
-    "ipop_bp",
-    "push_arg_addr",
-    "pop_arg_addr",
-    "set_arg_addr",
-    "ret_addr",
+    "enter",
+    "call",
     "print",
     "local_get_c",
     "local_get_i",
@@ -349,14 +461,67 @@ constexpr char const *instructions[] = {
     "get_arg_array_ref",
     "set_arg_array_ref",
 
-    "store_ret_value",
-    "load_ret_value",
-
     "cast_to_int",
     "cast_to_double",
     "cast_to_char",
     "cast_to_bool",
 
+    "add_int_int",
+    "sub_int_int",
+    "mult_int_int",
+    "idiv_int_int",
+    "mod_int_int",
+    "lt_int_int",
+    "lte_int_int",
+    "gt_int_int",
+    "gte_int_int",
+    "eq_int_int",
+    "neq_int_int",
+    "add_double_double",
+    "sub_double_double",
+    "mult_double_double",
+    "idiv_double_double",
+    "lt_double_double",
+    "lte_double_double",
+    "gt_double_double",
+    "gte_double_double",
+
+    "jif_local_lt_const",
+    "jif_local_lte_const",
+    "jif_local_gt_const",
+    "jif_local_gte_const",
+    "jif_local_lt_local",
+    "jif_local_lte_local",
+    "jif_local_gt_local",
+    "jif_local_gte_local",
+    "add_local_const",
+    "add_local_local",
+    "inc_local_discard",
+    "dec_local_discard",
+    "pop_jump",
+
+    "jit_call",
+
+    "move_r",
+    "add_r",
+    "sub_r",
+    "mult_r",
+    "idiv_r",
+    "mod_r",
+    "lt_r",
+    "lte_r",
+    "gt_r",
+    "gte_r",
+    "eq_r",
+    "neq_r",
+    "jit_r",
+    "jif_r",
+    "inc_r",
+    "dec_r",
+    "call_r",
+    "ret_r",
+    "set_sp",
+
     "ret",
     "main_ret"
 };
@@ -382,7 +547,159 @@ struct StringLiteral {
 
 char escape_character(char d);
 
+#if NCC_NAN_BOXING
+/* a nan boxed value only has room for an index, so every string a value
+ * refers to is kept here. handles are reused for the same text and length,
+ * which keeps strings made at runtime (get_string) from piling up */
+struct StringLiteralHash {
+    std::size_t operator()(StringLiteral str) const {
+        return std::hash<char const *>()(str.text) ^ (static_cast<std::size_t>(str.length) << 1);
+    }
+};
+
+struct StringLiteralEqual {
+    bool operator()(StringLiteral a, StringLiteral b) const {
+        return a.text == b.text && a.length == b.length;
+    }
+};
+
+vector<StringLiteral> string_heap;
+std::unordered_map<StringLiteral, u32_t, StringLiteralHash, StringLiteralEqual> string_handles;
+
+u32_t string_handle(StringLiteral str) {
+    auto handle = string_handles.find(str);
+    if (handle != string_handles.end())
+        return handle->second;
+
+    auto index = static_cast<u32_t>(string_heap.size());
+    string_heap.push_back(str);
+    string_handles.emplace(str, index);
+    return index;
+}
+
+struct Value;
+
+/* integers that do not fit in the 48 bit payload get a cell here. a loop
+ * can make a new one every iteration, so unlike strings the cells are
+ * collected: once the heap is at its limit, every cell that no value in
+ * roots refers to is freed. roots are the stack, the globals and the
+ * constants of the vm that runs. the whole stack is scanned, not only up to
+ * sp, so a value an instruction has popped but still uses stays alive */
+struct IntHeap {
+    u32_t box(i64_t val);
+    void collect();
+    void clear();
+
+    vector<i64_t> cells;
+    vector<u32_t> free_cells;
+    vector<u8_t> marks;
+    vector<vector<Value> const *> roots;
+    std::size_t limit = initial_limit;
+
+    static constexpr std::size_t initial_limit = 1 << 16;
+};
+
+IntHeap int_heap;
+#endif
+
 struct Value {
+#if NCC_NAN_BOXING
+    /* 8 byte value. doubles are stored as they are, every other kind goes
+     * into the 48 bit payload of a negative quiet nan, with tag
+     * (int_tag - kind) in the upper 16 bits. nans produced by arithmetic
+     * are made canonical, so they never look like a tagged value. they keep
+     * their sign, which prints. integers that need more than 48 bits get
+     * big_int_tag, right above int_tag, and an index into int_heap, so a
+     * single compare still tells whether a value is an integer */
+    static constexpr u64_t int_tag = 0xfffe;
+    static constexpr u64_t big_int_tag = int_tag + 1;
+    static constexpr u64_t first_tag = int_tag - Nil_v;
+    static constexpr u64_t payload_mask = (static_cast<u64_t>(1) << 48) - 1;
+    static constexpr u64_t canonical_nan = 0x7ff8000000000000;
+    static constexpr u64_t sign_bit = static_cast<u64_t>(1) << 63;
+    static_assert(((canonical_nan | sign_bit) >> 48) < first_tag, "a negative nan must not look like a tagged value");
+    static_assert(big_int_tag == 0xffff, "the big integer tag must be the last one");
+
+    static constexpr u64_t tagged(ValueKind kind, u64_t payload) {
+        return ((int_tag - kind) << 48) | (payload & payload_mask);
+    }
+
+    __attribute__((cold, noinline)) static u64_t big_int(i64_t val);
+
+    Value() = default;
+
+    Value(nullptr_t val)
+        : Value() { }
+
+    Value(char val) { *this = val; }
+    Value(bool val) { *this = val; }
+    Value(i64_t val) { *this = val; }
+    Value(double val, i8_t precision = 6) { *this = val; }
+    Value(Fraction val) { *this = val; }
+    Value(StringLiteral val) { *this = val; }
+
+    Value(char const *text, i32_t length)
+        : Value(StringLiteral{text, length}) { }
+
+    Value &operator=(nullptr_t val) { _bits = tagged(Nil_v, 0); return *this; }
+    Value &operator=(char val) { _bits = tagged(Char_v, static_cast<u8_t>(val)); return *this; }
+    Value &operator=(i64_t  val) {
+        if (static_cast<i64_t>(static_cast<u64_t>(val) << 16) >> 16 == val)
+            _bits = tagged(Int_v, static_cast<u64_t>(val));
+        else
+            _bits = big_int(val);
+        return *this;
+    }
+    Value &operator=(Fraction val) { return *this = val.val; }
+    Value &operator=(double val) {
+        if (val != val)
+            _bits = std::signbit(val) ? canonical_nan | sign_bit : canonical_nan;
+        else
+            std::memcpy(&_bits, &val, sizeof(val));
+        return *this;
+    }
+    Value &operator=(bool val) { _bits = tagged(Bool_v, val); return *this; }
+    Value &operator=(StringLiteral val) { _bits = tagged(String_v, string_handle(val)); return *this; }
+
+    ValueKind kind() const {
+        if (is_double())
+            return Double_v;
+        if (is_int())
+            return Int_v;
+        return static_cast<ValueKind>(int_tag - (_bits >> 48));
+    }
+
+    bool is_nil() const { return (_bits >> 48) == int_tag - Nil_v; }
+    bool is_char() const { return (_bits >> 48) == int_tag - Char_v; }
+    bool is_int() const { return (_bits >> 48) >= int_tag; }
+    /* the quickened and fused instructions only take these, a big integer
+     * sends them back to the generic form */
+    bool is_small_int() const { return (_bits >> 48) == int_tag; }
+    bool is_double() const { return (_bits >> 48) < first_tag; }
+    bool is_bool() const { return (_bits >> 48) == int_tag - Bool_v; }
+    bool is_string() const { return (_bits >> 48) == int_tag - String_v; }
+
+    char as_char() { return static_cast<char>(_bits); }
+    i64_t as_int() {
+        if ((_bits >> 48) == big_int_tag)
+            return int_heap.cells[_bits & payload_mask];
+        return as_small_int();
+    }
+    i64_t as_small_int() { return static_cast<i64_t>(_bits << 16) >> 16; }
+    double as_double() {
+        double val;
+        std::memcpy(&val, &_bits, sizeof(val));
+        return val;
+    }
+    char const *as_cstring() { return as_string().text; }
+    StringLiteral as_string() { return string_heap[_bits & payload_mask]; }
+    bool as_boolean() { return _bits & 1; }
+
+    /* doubles are always printed with the default precision */
+    i8_t precision() { return 6; }
+
+    u64_t _bits{ tagged(Nil_v, 0) };
+#else
     Value() = default;
 
     Value(nullptr_t val)
@@ -435,30 +752,49 @@ struct Value {
     Value &operator=(bool val) { _kind = Bool_v; _val.boolean = val; return *this; }
     Value &operator=(StringLiteral val) { _kind = String_v; _val.strings = val; return *this; }
 
+    ValueKind kind() const { return _kind; }
+
     bool is_nil() const { return _kind == Nil_v; }
     bool is_char() const { return _kind == Char_v; }
     bool is_int() const { return _kind == Int_v; }
+    bool is_small_int() const { return is_int(); }
     bool is_double() const { return _kind == Double_v; }
     bool is_bool() const { return _kind == Bool_v; }
     bool is_string() const { return _kind == String_v; }
 
     char as_char() { return _val.charcter; }
     i64_t as_int() { return _val.integer; }
+    i64_t as_small_int() { return as_int(); }
     double as_double() { return _val.floats.val; }
     char const *as_cstring() { return _val.strings.text; }
     StringLiteral as_string() { return _val.strings; }
+    bool as_boolean() { return _val.boolean; }
+
+    i8_t precision() { return _val.floats.precision; }
+
+    ValueKind _kind{ Nil_v };
+    union Val {
+        nullptr_t nil;
+        char charcter;
+        bool boolean;
+        i64_t integer;
+        Fraction floats;
+        StringLiteral strings;
+    } _val{ nullptr };
+#endif
+
     bool as_bool() { 
-        switch (_kind) {
+        switch (kind()) {
             case Bool_v:
-                return _val.boolean; 
+                return as_boolean(); 
             case Int_v:
-                return (_val.integer ? true : false);
+                return (as_int() ? true : false);
             case Double_v:
-                return (_val.floats.val ? true : false);
+                return (as_double() ? true : false);
             case Char_v:
-                return (_val.charcter == '\0'? false : true);
+                return (as_char() == '\0'? false : true);
             case String_v:
-                return _val.strings.length > 0;
+                return as_string().length > 0;
             case Nil_v:
                 return false;
         }
@@ -496,99 +832,230 @@ struct Value {
     }
 
     void print(FILE *des = stdout, bool escape = true) {
-        switch (_kind) {
+        switch (kind()) {
             case Int_v:
-                std::fprintf(des, "%lld", static_cast<long long>( _val.integer));
+                std::fprintf(des, "%lld", static_cast<long long>(as_int()));
                 break;
             case Char_v:
                 if (escape)
-                    std::fprintf(des, "%c", _val.charcter);
+                    std::fprintf(des, "%c", as_char());
                 else
-                    escaped_character(des, _val.charcter);
+                    escaped_character(des, as_char());
                 break;
             case Double_v:
-                std::fprintf(des, "%.*lF", _val.floats.precision, _val.floats.val);
+                std::fprintf(des, "%.*lF", precision(), as_double());
                 break;
             case Bool_v:
-                std::fprintf(des, "%s", (_val.boolean ? "true" : "false"));
+                std::fprintf(des, "%s", (as_boolean() ? "true" : "false"));
                 break;
             case String_v:
-                if (escape)
-                    escape_string(des, _val.strings.text, _val.strings.length);
-                else
-                    std::fprintf(des, "%.*s", _val.strings.length, _val.strings.text);
+                {
+                    auto str = as_string();
+                    if (escape)
+                        escape_string(des, str.text, str.length);
+                    else
+                        std::fprintf(des, "%.*s", str.length, str.text);
+                }
                 break;
             case Nil_v:
                 std::fprintf(des, "nil");
                 break;
         }
     }
-
-    ValueKind _kind{ Nil_v };
-    union Val {
-        nullptr_t nil;
-        char charcter;
-        bool boolean;
-        i64_t integer;
-        Fraction floats;
-        StringLiteral strings;
-    } _val{ nullptr };
 };
 
+#if NCC_NAN_BOXING
+/* kept out of Value, so the rare heap cell does not end up inlined into
+ * every instruction that makes an integer */
+u64_t Value::big_int(i64_t val) {
+    return (big_int_tag << 48) | int_heap.box(val);
+}
+
+u32_t IntHeap::box(i64_t val) {
+    if (free_cells.empty() && cells.size() >= limit)
+        collect();
 
-/* -------------- globals -------------- */
-char *source = nullptr;
-i32_t source_length = 0;
-i32_t source_index = 0; 
+    if (free_cells.empty()) {
+        cells.push_back(val);
+        return static_cast<u32_t>(cells.size() - 1);
+    }
+    auto index = free_cells.back();
+    free_cells.pop_back();
+    cells[index] = val;
+    return index;
+}
+
+void IntHeap::collect() {
+    /* without a vm nothing can be freed, values may be anywhere */
+    if (roots.empty()) {
+        limit = cells.size() * 2;
+        return;
+    }
+
+    std::size_t scanned = 0;
+    marks.assign(cells.size(), 0);
+    for (auto root : roots) {
+        for (auto val : *root) {
+            if ((val._bits >> 48) == Value::big_int_tag)
+                marks[val._bits & Value::payload_mask] = 1;
+        }
+        scanned += root->size();
+    }
+
+    free_cells.clear();
+    for (std::size_t i = 0; i < cells.size(); ++i) {
+        if (!marks[i])
+            free_cells.push_back(static_cast<u32_t>(i));
+    }
+
+    /* keep at least half of the heap free and do not scan the roots
+     * more often than once per their size of new cells */
+    auto live = cells.size() - free_cells.size();
+    limit = std::max({limit, live * 2, scanned});
+}
+
+void IntHeap::clear() {
+    cells.clear();
+    free_cells.clear();
+    marks.clear();
+    limit = initial_limit;
+}
+#endif
 
+/* -------------- globals -------------- */
 bool show_opcodes = false;
+bool use_jit = false;
+
+/* code after decode(), one fixed size record per instruction, so that
+ * the vm never has to put operands together from bytes */
+struct Instruction {
+    OpCode op;
+    u8_t count;     /* array/string size or print argument count */
+    i32_t operand;  /* constant or variable index, or index of the jump target */
+    i32_t offset;   /* offset of the instruction in code, for errors and -d */
+    i16_t src1 = 0; /* source registers of the register forms */
+    i16_t src2 = 0;
+};
+
+/* the vm stack starts small and grows on the heap, see grow_stack() */
+constexpr i32_t initial_stack_size = 1024;
+constexpr i32_t max_stack_size = 1 << 22;
+
+/* a call pushes a frame and ret pops it again. bp is kept as an index, as
+ * grow_stack() moves the stack */
+struct Frame {
+    i32_t return_ip;    /* index of the instruction after the call */
+    i32_t bp;           /* bp of the caller */
+    i32_t arguments;
+};
+constexpr i32_t max_call_depth = max_stack_size / 2;
 
-char const *text = source; /* to store the current lexme */
-i32_t text_len = 0;     /* current lexme's length */
+/* source line of every byte of code. consecutive bytes mostly come from
+ * the same line, so only the offsets where the line changes are kept */
+struct LineRun {
+    i32_t offset;   /* first byte of code on this line */
+    i32_t line;
+};
 
-i32_t line = 1;
+struct LineTable {
+    void push(i32_t line) {
+        if (runs.empty() || runs.back().line != line)
+            runs.push_back({length, line});
+        ++length;
+    }
 
-Token cur_token = {Eof, line};
+    i32_t at(i32_t offset) const {
+        if (offset < 0 || offset >= length)
+            throw std::out_of_range("LineTable::at");
+        auto run = std::upper_bound(runs.begin(), runs.end(), offset,
+                [](i32_t offset, LineRun const &run) { return offset < run.offset; });
+        return (run - 1)->line;
+    }
 
-bool compile_error = false;
-bool parse_error = false;
-bool execution_error = false;
+    /* forgets the lines of the bytes from size on */
+    void resize(i32_t size) {
+        while (!runs.empty() && runs.back().offset >= size)
+            runs.pop_back();
+        length = size;
+    }
 
-vector<u8_t> code;  /* this will be our vector of opcodes */
-vector<u8_t>::iterator ip; /* our instruction pointer */
+    void clear() {
+        runs.clear();
+        length = 0;
+    }
 
-array<Value, INT16_MAX> stack;
-auto sp = stack.begin();    /* stack pointer */
-auto bp = stack.begin();    /* base pointer */
-i32_t main_addr = -1;
+    i32_t size() const { return length; }
 
-vector<Value> values;
-vector<i32_t> lines;
+    vector<LineRun> runs;
+    i32_t length = 0;   /* bytes of code covered */
+};
 
 struct SourceCode {
     char const *text;
     i32_t length;
 };
 
-vector<SourceCode> sourcecode;
-char const *cur_line = source;
-i32_t cur_line_length = 0;
-
-u8_t print_arguments = 0;
+constexpr i32_t recent_identifiers_size = 256;
+
+/* every distinct identifier gets a small id the first time the lexer sees
+ * it, and the symbol tables below are indexed by that id instead of
+ * comparing names. the parser mostly looks up names the lexer has just
+ * gone over, so the ids of the last ones are kept by their offset in the
+ * source and those are not hashed again. this is direct mapped like the
+ * token cache */
+struct Identifiers {
+    Identifiers(char const *const &source, i32_t const &source_length)
+        : source(source), source_length(source_length) { }
+
+    u32_t intern(char const *name, i32_t length) {
+        if (name < source || name >= source + source_length)
+            return lookup(name, length);
+
+        auto offset = i32_t(name - source);
+        auto &entry = recent[offset % recent_identifiers_size];
+        if (entry.offset != offset || names[entry.id].length != length)
+            entry = {offset, lookup(name, length)};
+        return entry.id;
+    }
+
+    u32_t lookup(char const *name, i32_t length) {
+        if (names.empty())
+            names.push_back({nullptr, 0});  /* id 0 is no identifier */
+        auto [it, inserted] = ids.try_emplace(std::string_view(name, length), u32_t(names.size()));
+        if (inserted)
+            names.push_back({name, length});
+        return it->second;
+    }
+
+    char const *const &source;  /* of the compiler the identifiers are from */
+    i32_t const &source_length;
+    std::unordered_map<std::string_view, u32_t> ids;
+    vector<StringLiteral> names;
+    struct Recent {
+        i32_t offset{ -1 };
+        u32_t id;
+    };
+    std::array<Recent, recent_identifiers_size> recent;
+};
 
+/* the entry of a table that belongs to an identifier, tables only grow
+ * when a new identifier shows up */
+template <typename T>
+T &id_slot(vector<T> &table, u32_t id, T none) {
+    if (id >= table.size())
+        table.resize(id + 1, none);
+    return table[id];
+}
 
 struct GlobalSymbolTable {
-    GlobalSymbolTable() = default;
+    explicit GlobalSymbolTable(Identifiers &identifiers) : identifiers(identifiers) { }
 
     bool contains(StringLiteral literal, i32_t &index) {
-        for (i32_t i = 0; i < i32_t(objects.size()); ++i) {
-            if (objects[i].length == literal.length &&
-                    std::strncmp(objects[i].text, literal.text, objects[i].length) == 0) {
-                index = i;
-                return true;
-            }
-        }
-        return false;
+        auto found = id_slot(by_id, identifiers.intern(literal.text, literal.length), -1);
+        if (found < 0)
+            return false;
+        index = found;
+        return true;
     }
 
     bool contains(StringLiteral literal) {
@@ -600,6 +1067,7 @@ struct GlobalSymbolTable {
         i32_t index = objects.size();;
         objects.push_back({literal.text, literal.length});
         vals.push_back(val);
+        id_slot(by_id, identifiers.intern(literal.text, literal.length), -1) = index;
         return index;
     }
 
@@ -607,12 +1075,12 @@ struct GlobalSymbolTable {
         return vals.at(index);
     }
     
+    Identifiers &identifiers;
     vector<StringLiteral> objects;
     vector<Value> vals;
+    vector<i32_t> by_id;    /* index of the global with that identifier or -1 */
 };
 
-GlobalSymbolTable globals2;
-
 struct Variable {
     char const *name;
     i32_t length;
@@ -621,44 +1089,52 @@ struct Variable {
     i16_t scope;
     bool reference;
     bool is_string;
+    u32_t id;
+    i32_t shadowed;     /* the variable of the same name this one hides, or -1 */
+    bool is_constant = false;   /* never written after its constant initializer, */
+    Value constant{};           /* which is pushed wherever it is read */
 };
 
-i32_t cur_scope_depth = 0;
-i32_t cur_local_index = 0;
 struct SymbolTable {
-    SymbolTable() = default;
+    SymbolTable(Identifiers &identifiers, i32_t &cur_scope_depth, i32_t &cur_local_index)
+        : identifiers(identifiers), cur_scope_depth(cur_scope_depth), cur_local_index(cur_local_index) { }
 
-    u16_t push(i32_t scope = cur_scope_depth, 
-            char const *name = text, i32_t length = text_len, u8_t count = 1) {
-        i32_t index = cur_local_index++;
-        variables.push_back(Variable{name, length, index, count , i16_t(scope), false, false});
-        return index;
+    u16_t push(i32_t scope, char const *name, i32_t length, u8_t count) {
+        return push(scope, name, length, count, cur_local_index++);
     }
 
     u16_t push(i32_t scope, char const *name, i32_t length, u8_t count, i32_t index) {
-        variables.push_back(Variable{name, length, index, count , i16_t(scope), false, false});
-        return index;
+        return push(scope, name, length, count, index, false);
     }
 
     u16_t push(i32_t scope, char const *name, i32_t length, u8_t count, i32_t index, bool is_string) {
-        variables.push_back(Variable{name, length, index, count , i16_t(scope), false, is_string});
+        auto id = identifiers.intern(name, length);
+        auto &innermost = id_slot(bound, id, -1);
+        variables.push_back(Variable{name, length, index, count , i16_t(scope), false, is_string, id, innermost});
+        innermost = variables.size() - 1;
         return index;
     }
 
     void pop() {
+        bound[variables.back().id] = variables.back().shadowed;
         variables.pop_back();
     }
 
+    /* position of the innermost variable with that name in variables or -1 */
+    i32_t find(char const *name, i32_t length) {
+        return id_slot(bound, identifiers.intern(name, length), -1);
+    }
+
     bool contains(char const *name, i32_t length, i32_t scope, i32_t &index, u8_t &count) {
-        for (auto var = variables.rbegin(); var != variables.rend(); ++var) {
-            if (var->scope < cur_scope_depth)
+        for (auto pos = find(name, length); pos >= 0; pos = variables[pos].shadowed) {
+            auto &var = variables[pos];
+            if (var.scope < cur_scope_depth)
                 break;
 
-            if (var->scope == scope && var->length == length 
-                    && std::strncmp(var->name, name, length) == 0) {
-                index = var->index;
-                /* reference = var->reference; */
-                count = var->count;
+            if (var.scope == scope) {
+                index = var.index;
+                /* reference = var.reference; */
+                count = var.count;
                 return true;
             }
         }
@@ -668,52 +1144,44 @@ struct SymbolTable {
     }
 
     bool contains(i32_t scope, char const *name, i32_t length) {
-        for (auto var = variables.rbegin(); var != variables.rend(); ++var) {
-            if (var->scope < cur_scope_depth)
+        for (auto pos = find(name, length); pos >= 0; pos = variables[pos].shadowed) {
+            if (variables[pos].scope < cur_scope_depth)
                 break;
 
-            if (var->scope == scope && var->length == length 
-                    && std::strncmp(var->name, name, length) == 0) {
+            if (variables[pos].scope == scope)
                 return true;
-            }
         }
 
         return false;
     }
 
     bool contains(char const *name, i32_t length, i32_t &index) {
-        for (auto var = variables.rbegin(); var != variables.rend(); ++var) {
-            if (var->length == length && std::strncmp(var->name, name, length) == 0) {
-                index = var->index;
-                return true;
-            }
-        }
-        return false;
+        auto pos = find(name, length);
+        if (pos < 0)
+            return false;
+        index = variables[pos].index;
+        return true;
     }
 
     bool contains(char const *name, i32_t length, i32_t &index, bool &reference, u8_t &count) {
-        for (auto var = variables.rbegin(); var != variables.rend(); ++var) {
-            if (var->length == length && std::strncmp(var->name, name, length) == 0) {
-                index = var->index;
-                reference = var->reference;
-                count = var->count;
-                return true;
-            }
-        }
-        return false;
+        auto pos = find(name, length);
+        if (pos < 0)
+            return false;
+        index = variables[pos].index;
+        reference = variables[pos].reference;
+        count = variables[pos].count;
+        return true;
     }
 
     bool contains(char const *name, i32_t length, i32_t &index, bool &reference, u8_t &count, bool &is_string) {
-        for (auto var = variables.rbegin(); var != variables.rend(); ++var) {
-            if (var->length == length && std::strncmp(var->name, name, length) == 0) {
-                index = var->index;
-                reference = var->reference;
-                count = var->count;
-                is_string = var->is_string;
-                return true;
-            }
-        }
-        return false;
+        auto pos = find(name, length);
+        if (pos < 0)
+            return false;
+        index = variables[pos].index;
+        reference = variables[pos].reference;
+        count = variables[pos].count;
+        is_string = variables[pos].is_string;
+        return true;
     }
 
     Variable &back() {
@@ -724,11 +1192,13 @@ struct SymbolTable {
         return variables.at(variables.size() - 1 - offset);
     }
 
+    Identifiers &identifiers;
+    i32_t &cur_scope_depth;     /* of the compiler */
+    i32_t &cur_local_index;
     vector<Variable> variables;
+    vector<i32_t> bound;    /* innermost variable of each identifier, see find() */
 };
 
-SymbolTable locals;
-
 
 struct Function {
     char const *name;
@@ -736,50 +1206,359 @@ struct Function {
     i32_t address;
     i8_t arguments;
     vector<u8_t> argumets_with_ref;
+    i32_t end = -1;     /* offset of the ret or main_ret it ends with */
 };
 
 struct Functions {
-    Functions() = default;
+    explicit Functions(Identifiers &identifiers) : identifiers(identifiers) { }
 
     bool defined(char const *name, i32_t length, i32_t &address, i8_t &arguments, vector<u8_t> &refs) {
-        for (auto func = functions.begin(); func != functions.end(); ++func) {
-            if (func->length == length &&
-                    std::strncmp(func->name, name, length) == 0) {
-                address = func->address;
-                arguments = func->arguments;
-                refs = func->argumets_with_ref;
-                return true;
-            }
-        }
+        auto found = id_slot(by_id, identifiers.intern(name, length), -1);
+        if (found < 0)
+            return false;
 
-        return false;
+        auto &func = functions[found];
+        address = func.address;
+        arguments = func.arguments;
+        refs = func.argumets_with_ref;
+        return true;
     }
 
     bool defined(char const *name, i32_t length) {
-        i32_t address;
-        i8_t arguments;
-        vector<u8_t> dummy;
-        vector<u8_t> &refs = dummy;
-        return defined(name, length, address, arguments, refs);
+        return id_slot(by_id, identifiers.intern(name, length), -1) >= 0;
     }
 
     bool declare(char const *name, i32_t length, i32_t address, i8_t arguments, vector<u8_t> &&refs) {
-        if (defined(name, length))
+        auto &found = id_slot(by_id, identifiers.intern(name, length), -1);
+        if (found >= 0)
             return false;
+        found = functions.size();
         functions.push_back({name, length, address, arguments, std::move(refs)});
         return true;
     }
 
+    Identifiers &identifiers;
     vector<Function> functions;
+    vector<i32_t> by_id;    /* index of the function with that identifier or -1 */
+};
+
+/* the last call compiled, start and end of its call instruction */
+struct CallSite {
+    i32_t start{ -1 };
+    i32_t end{ -1 };
+    i32_t address;
+    i8_t arguments;
+    bool references;
+};
+
+/* a constant the code pushes with a single instruction at [start, end),
+ * remembered so the operators applied to it can be done while compiling */
+struct ConstantPush {
+    i32_t start;
+    i32_t end;
+    Value val;
+};
+
+struct Lexeme {
+    i32_t start{ -1 };  /* source_index and line before the token */
+    i32_t start_line;
+    i32_t offset;       /* of text in source */
+    i32_t length;
+    i32_t end;          /* source_index and line after the token */
+    i32_t line;
+    TokenKind kind;
 };
 
+constexpr i32_t token_cache_size = 256;
+
+struct CapturedCode;
+
+/* everything a compile of one script needs and makes. code and its
+ * constants, lines and symbols stay with the compiler for as long as a VM
+ * runs them, names and strings point into the source or the cache */
+struct Compiler {
+    Compiler();
+    ~Compiler();
+    Compiler(Compiler const &) = delete;
+    Compiler &operator=(Compiler const &) = delete;
+
+    /* source */
+    bool read_file(char const *argv);
+    void close_source();
+    void save_all_lines();
+    SourceCode &source_line(i32_t index);
+    i16_t get_double_byte_index(i32_t offset);
+    i32_t get_quad_byte_index(i32_t offset);
+
+    /* disassembler */
+    void double_byte_instruction(OpCode opcode, i32_t offset);
+    void five_byte_instruction(OpCode opcode, i32_t &offset);
+    void immediate_instruction(OpCode opcode, i32_t &offset);
+    void jump_true_false_instruction(OpCode opcode, i32_t &offset);
+    void get_globals(OpCode opcode, i32_t &offset);
+    void get_locals(OpCode opcode, i32_t &offset);
+    void disassemble_instruction(i32_t &offset);
+    void disassemble_code(char const *part);
+
+    /* code generation */
+    void emit_single_byte(u8_t byte, i32_t _line);
+    void emit_single_byte(u8_t byte) { emit_single_byte(byte, cur_token.line); }
+    void emit_double_byte(u8_t byte1, u8_t byte2, i32_t _line);
+    void emit_double_byte(u8_t byte1, u8_t byte2) { emit_double_byte(byte1, byte2, cur_token.line); }
+    i32_t intern_constant(Value val);
+    void emit_value(OpCode op, Value val, i32_t _line);
+    void emit_value(OpCode op, Value val) { emit_value(op, val, cur_token.line); }
+    void emit_three_bytes(OpCode op, i16_t index, i32_t _line);
+    void emit_three_bytes(OpCode op, i16_t index) { emit_three_bytes(op, index, cur_token.line); }
+    void emit_five_bytes(OpCode op, i32_t address, i32_t _line);
+    void emit_five_bytes(OpCode op, i32_t address) { emit_five_bytes(op, address, cur_token.line); }
+    void emit_jump(OpCode op, i32_t _line);
+    void emit_jump(OpCode op) { emit_jump(op, cur_token.line); }
+    void emit_array_indexing(OpCode op, i16_t index, u8_t count, i32_t _line);
+    void emit_array_indexing(OpCode op, i16_t index, u8_t count) { emit_array_indexing(op, index, count, cur_token.line); }
+    void set_correct_code_address(i32_t index, i32_t offset);
+    void truncate_code(i32_t size);
+    CapturedCode capture_code(i32_t start);
+    void emit_captured(CapturedCode const &captured);
+    i32_t trailing_constants(i32_t n);
+    void emit_constant(Value val, i32_t _line);
+    void emit_constant(Value val) { emit_constant(val, cur_token.line); }
+    void emit_binary(OpCode op, i32_t _line);
+    void emit_binary(OpCode op) { emit_binary(op, cur_token.line); }
+    void emit_unary(OpCode op, i32_t _line);
+    void emit_unary(OpCode op) { emit_unary(op, cur_token.line); }
+    void fold_short_circuit(ConstantPush left, i32_t right_start, bool decided_by);
+
+    /* errors and lexer */
+    void print_error_line(int offset, char const *_text);
+    void print_error_line(int offset) { print_error_line(offset, text); }
+    void erroneous_token(char const *tok, i32_t length);
+    bool is_eof();
+    char eat_c();
+    char peek_c();
+    char peek_next_c();
+    void error_token(char const *message, char const *_text, i32_t _line);
+    void error_token(char const *message) { error_token(message, text, line); }
+    void error_token(char const *message, char const *_text) { error_token(message, _text, line); }
+    void unterminated_string(char const *text, i32_t _line);
+    void unterminated_string(char const *text) { unterminated_string(text, line); }
+    void unterminated_print_argument();
+    void empty_print_argument(char const *text, i32_t _line);
+    void empty_print_argument(char const *text) { empty_print_argument(text, line); }
+    void skip_to(i32_t index);
+    template <typename... Stops> u32_t stop_mask(i32_t index, Stops... stops);
+    i32_t skip_blanks(i32_t index);
+    i32_t find_line_end(i32_t index);
+    i32_t find_string_special(i32_t index);
+    void skip_whitespace(bool save_line = true);
+    TokenKind number_token();
+    TokenKind char_token(bool print_error = true);
+    TokenKind string_token(bool print_error = true);
+    TokenKind identifier_token();
+    TokenKind lex_token(bool save_line);
+    TokenKind gettoken(bool save_line = true);
+    TokenKind peek_token(bool save_cur = true, int count = 0);
+    bool match_token(TokenKind kind);
+
+    /* parser */
+    void unexpected_token(char const *expected, Token &tok);
+    void expected_expression(Token &tok);
+    void redefining_variable(char const *text, i32_t length, i32_t _line);
+    void redefining_variable(char const *text, i32_t length) { redefining_variable(text, length, line); }
+    void redefining_function(char const *text, i32_t length, i32_t _line);
+    void redefining_function(char const *text, i32_t length) { redefining_function(text, length, line); }
+    void undefined_reference(char const *_text, i32_t _length, i32_t _line);
+    void undefined_reference() { undefined_reference(text, text_len, line); }
+    void consume(TokenKind kind);
+    void synchronize();
+    i16_t index_of(char const *text, i32_t length, bool &is_global, bool &reference, u8_t &count, bool &is_string);
+    i16_t index_of(char const *text, i32_t length, bool &is_global, bool &reference, u8_t &count);
+    void function_call();
+    void parse_primary_expression();
+    void unary_expression(i8_t parentPrecedence);
+    void binary_expression(i8_t parentPrecedence);
+    void parse_expression(i8_t parentPrecedence = 0);
+    void parse_assignment(i8_t parentPrecedence = 0);
+    void parse_print_arguments();
+    void parse_print_statement();
+    void parse_expression_statement();
+    void start_new_scope();
+    void end_new_scope();
+    void parse_declarations();
+    void parse_block_statement();
+    void parse_constant_if(bool taken, i32_t start);
+    void parse_if_statement();
+    void parse_while_statement();
+    void parse_for_statement();
+    void parse_for_loop_effeciently();
+    bool is_tail_call();
+    void parse_return_statement();
+    void parse_input_statement(OpCode op1, OpCode op2, OpCode op3, OpCode op4 = main_ret);
+    void parse_get_c();
+    void parse_get_i();
+    void parse_get_d();
+    void parse_get_s();
+    void parse_statement(TokenKind kind);
+    void define_variable(char const *identifier, i32_t identifier_len, i32_t _line, u8_t count, i32_t index = -1);
+    void find_written_locals();
+    void parse_variable_declaration(bool consume_semicolon = true);
+    void parse_function_body();
+    void parse_function_declaration();
+    void define_string(char const *name, i32_t length, i32_t _line, i32_t index, u8_t count);
+    void parse_string_declaration();
+    void parse_declaration(TokenKind kind);
+    void parse_functions(TokenKind kind);
+    void remove_unused_functions();
+    bool compile();
+
+    /* bytecode cache, see CacheHeader */
+    void save_cache(char const *file);
+    bool map_cache(std::string const &path);
+    void unmap_cache();
+    bool load_cache(char const *file);
+    bool valid_cache_code();
+
+    char const *source = nullptr;
+    i32_t source_length = 0;
+    i32_t source_index = 0;
+    std::size_t source_size = 0;    /* of the buffer or the mapping */
+
+    char const *text = nullptr; /* to store the current lexme */
+    i32_t text_len = 0;     /* current lexme's length */
+    i32_t line = 1;
+    Token cur_token = {Eof, 1};
+    std::array<Lexeme, token_cache_size> token_cache;
+
+    bool compile_error = false;
+    bool parse_error = false;
+
+    vector<u8_t> code;  /* this will be our vector of opcodes */
+    vector<Value> values;
+    LineTable lines;
+    vector<SourceCode> sourcecode;
+    char const *cur_line = nullptr;
+    i32_t cur_line_length = 0;
+    u8_t print_arguments = 0;
+
+    Identifiers identifiers{source, source_length};
+    GlobalSymbolTable globals2{identifiers};
+    i32_t cur_scope_depth = 0;
+    i32_t cur_local_index = 0;
+    SymbolTable locals{identifiers, cur_scope_depth, cur_local_index};
+    Functions functions{identifiers};
+    bool return_found = false;
+    i32_t return_end = -1;      /* code.size() right after the last ret a return compiled */
+    i32_t cur_function = -1;    /* in functions, the one being compiled */
+    CallSite last_call;
+    vector<i32_t> global_codes;
+    i32_t main_addr = -1;
+
+    std::unordered_map<std::string, i32_t> constant_indexes;
+    i32_t constants_indexed = 0;    /* values before this one are in constant_indexes */
+    vector<ConstantPush> constant_pushes;
+    i32_t last_jump_target = 0;     /* no jump lands after this offset */
+    std::unordered_set<i32_t> written_locals;   /* see find_written_locals() */
+
+    /* the loaded cache has to stay around, the names and string constants of
+     * the program point into it */
+    char const *cache_data = nullptr;
+    std::size_t cache_size = 0;
+};
+
+#if NCC_JIT
+using JitEntry = bool (*)(void *);
+#endif
 
-Functions functions;
-vector<u32_t> argument_indexes(INT16_MAX, 0);
-Value function_return_value;
-vector<i32_t> exit_addrs;
-bool return_found = false;
-vector<i32_t> global_codes;
+/* runs what a compiler made. a VM is good for one run, the compiler has to
+ * outlive it */
+struct VM {
+    explicit VM(Compiler &compiler);
+    ~VM();
+    VM(VM const &) = delete;
+    VM &operator=(VM const &) = delete;
+
+    /* decoder, inliner and register translation */
+    i32_t program_index(i32_t offset);
+    void move_program_indexes(vector<i32_t> const &moved);
+    bool frame_depths(i32_t entry, i32_t end, vector<i32_t> &depth);
+    i32_t frame_size(i32_t entry, i32_t end, vector<i32_t> &depth);
+    i32_t function_end(Function const &function);
+    void size_frames();
+    void decode();
+    bool inlinable(i32_t entry, i32_t end);
+    void inline_calls();
+    void pool_immediates();
+    void disassemble_register(Instruction const &inst);
+    void registerize();
+
+    /* superinstructions */
+    void count_ngram(i32_t index);
+    void print_ngrams();
+    void fuse();
+
+    /* jit, which does nothing without NCC_JIT */
+    void jit_compile();
+    bool jit_run(Instruction const &inst);
+
+    /* runtime */
+    void runtime_error(char const *message, int offset);
+    bool grow_stack(i32_t size, i32_t offset);
+    void push(i64_t val);
+    void push(char val);
+    void push(double val);
+    void push(nullptr_t val);
+    void push(bool val);
+    void push(StringLiteral val);
+    void push(char const *text, i32_t length);
+    void push(Value &val);
+    Value &pop();
+    Value &peek(i32_t offset = 0);
+    void push_frame(Instruction const &inst);
+    void pop_frame(Value val);
+    bool register_binary(OpCode op, Value val1, Value val2, Value &result, i32_t offset);
+    void print_function(u8_t print_args);
+    bool execute(bool single_step);
+    bool run_vm();
+
+    Compiler &compiler;
+    vector<u8_t> &code;     /* the ones of the compiler */
+    vector<Value> &values;
+    LineTable &lines;
+    GlobalSymbolTable &globals2;
+    Functions &functions;
+    vector<i32_t> &global_codes;
+    i32_t &main_addr;
+
+    vector<Instruction> program;
+    vector<Instruction>::iterator ip; /* our instruction pointer */
+    vector<Value> stack = vector<Value>(initial_stack_size);
+    Value *sp = stack.data();   /* stack pointer */
+    Value *bp = stack.data();   /* base pointer */
+    vector<Frame> frames;
+
+    /* program index of the instruction that starts at each offset of code.
+     * inlined instructions keep the offsets of the function they came from,
+     * so program is not in the order of code */
+    vector<i32_t> program_indexes;
+
+    vector<array<u64_t, 3>> ngram_runs;     /* see count_ngram() */
+    i32_t ngram_last = -1;
+    i32_t ngram_length = 0;
+
+    Value nil_value{};
+    char temp[1000];    /* text of the strings the string instructions make */
+
+#if NCC_JIT
+    JitEntry jit_enter = nullptr;
+    vector<void *> jit_functions;   /* indexed by the operand of jit_call */
+    vector<i32_t> jit_targets;      /* the entry in program of each of them */
+    i32_t jit_return = -1;          /* main_ret that ends a function the interpreter runs for compiled code */
+    u64_t jit_saved_rsp = 0;
+    u64_t jit_native_stack_base = 0;
+    void *jit_code = nullptr;       /* the mapping jit_compile() made */
+    std::size_t jit_code_size = 0;
+#endif
+};
 
 
 
@@ -812,7 +1591,58 @@ inline T *as_ptr(N *as) {
 #define NORMAL "\033[0m"
 #endif
 
-bool read_file(char const *argv) {
+/* zeros after the source, so the lexer can read it 16 bytes at a time */
+constexpr i32_t source_padding = 16;
+
+#if NCC_NAN_BOXING
+/* strings in string_heap and integers in int_heap belong to the compilers
+ * that are alive, the heaps are emptied once the last one is gone */
+i32_t live_compilers = 0;
+#endif
+
+Compiler::Compiler() {
+#if NCC_NAN_BOXING
+    ++live_compilers;
+#endif
+}
+
+Compiler::~Compiler() {
+    close_source();
+    unmap_cache();
+#if NCC_NAN_BOXING
+    if (--live_compilers == 0) {
+        string_heap.clear();
+        string_handles.clear();
+        int_heap.clear();
+    }
+#endif
+}
+
+bool Compiler::read_file(char const *argv) {
+#ifdef __linux
+    /* the file is mapped read only over a zeroed area that is a bit longer,
+     * which gives the lexer its padding without copying the file */
+    int fd = open(argv, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            close(fd);
+        std::fprintf(stderr, "ncc:" BOLD_RED " error" NORMAL ": no such file or directory\n");
+        return false;
+    }
+
+    auto fsize = as_t<long long>(st.st_size);
+    source_size = fsize + 1 + source_padding;
+    void *area = mmap(nullptr, source_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED || (fsize > 0
+                && mmap(area, fsize, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+        close(fd);
+        std::fprintf(stderr, "ncc:" BOLD_RED " error" NORMAL ": could not read the file\n");
+        return false;
+    }
+    close(fd);
+    source = static_cast<char const *>(area);
+#else
     std::ifstream file(argv, std::ios::in | std::ios::binary);
     if (!file.is_open()) {
         std::fprintf(stderr, "ncc:" BOLD_RED " error" NORMAL ": no such file or directory\n");
@@ -824,18 +1654,32 @@ bool read_file(char const *argv) {
     auto fsize = as_t<long long>(file.tellg());
     file.seekg(0, std::ios::beg);
 
-    source = new char[fsize + 1];
-    file.read(source, fsize);
-    source[fsize] = '\0';
+    source_size = fsize + 1 + source_padding;
+    auto buffer = new char[source_size]();
+    file.read(buffer, fsize);
+    source = buffer;
+#endif
 
-    while (source[fsize - 1] == '\n')
-        source[--fsize] = '\0';
+    /* trailing newlines are left out of the source */
+    while (fsize > 0 && source[fsize - 1] == '\n')
+        --fsize;
     source_length = fsize;
     cur_line = source;
     return true;
 }
 
-void save_all_lines() {
+void Compiler::close_source() {
+    if (!source)
+        return;
+#ifdef __linux
+    munmap(const_cast<char *>(source), source_size);
+#else
+    delete[] source;
+#endif
+    source = nullptr;
+}
+
+void Compiler::save_all_lines() {
     for (i32_t i = 0; i <= source_length; ++i) {
         if (source[i] == '\n' || source[i] == '\0') {
             sourcecode.push_back({cur_line, cur_line_length});
@@ -847,62 +1691,86 @@ void save_all_lines() {
     }
 }
 
-i16_t get_double_byte_index(i32_t offset) {
+/* the lines are only split up once an error message needs one of them */
+SourceCode &Compiler::source_line(i32_t index) {
+    if (sourcecode.empty())
+        save_all_lines();
+    return sourcecode.at(index);
+}
+
+i16_t Compiler::get_double_byte_index(i32_t offset) {
     auto byte1 = code.at(offset);
     auto byte2 = code.at(offset + 1);
 
     return as_t<i16_t>(as_t<i16_t>(byte1 << 8) | as_t<i16_t>(byte2));
 }
 
+/* constant indexes and code addresses take four bytes */
+i32_t Compiler::get_quad_byte_index(i32_t offset) {
+    u32_t index = 0;
+    for (i32_t i = 0; i < 4; ++i)
+        index = (index << 8) | code.at(offset + i);
+
+    return as_t<i32_t>(index);
+}
+
 void single_byte_instruction(OpCode opcode) {
     std::fprintf(stderr,"%20s\n", instructions[opcode]);
 }
 
-void double_byte_instruction(OpCode opcode, i32_t offset) {    
+void Compiler::double_byte_instruction(OpCode opcode, i32_t offset) {
     std::fprintf(stderr, "%20s\t%4d\n", instructions[opcode], code.at(offset));
 }
 
-void three_byte_instruction(OpCode opcode, i32_t &offset) {
-    auto index = get_double_byte_index(offset);
+void Compiler::five_byte_instruction(OpCode opcode, i32_t &offset) {
+    auto index = get_quad_byte_index(offset);
     std::fprintf(stderr, "%20s\t%4d\t", instructions[opcode], index);
     values.at(index).print(stderr, false);
     std::fprintf(stderr, "\n");
-    offset += 1;
+    offset += 3;
 }
 
-void jump_true_false_instruction(OpCode opcode, i32_t &offset) {
-    auto index = get_double_byte_index(offset);
+void Compiler::immediate_instruction(OpCode opcode, i32_t &offset) {
+    std::fprintf(stderr, "%20s\t%4d\n", instructions[opcode], get_quad_byte_index(offset));
+    offset += 3;
+}
+
+void Compiler::jump_true_false_instruction(OpCode opcode, i32_t &offset) {
+    auto index = get_quad_byte_index(offset);
     std::fprintf(stderr, "%20s\t%4d\t%15s\n", instructions[opcode], index, instructions[code.at(index)]);
-    offset += 1;
+    offset += 3;
 }
 
-void get_globals(OpCode opcode, i32_t &offset) {
+void Compiler::get_globals(OpCode opcode, i32_t &offset) {
     auto index = get_double_byte_index(offset);
     auto val = globals2.objects[index];
     std::fprintf(stderr, "%20s\t%4d\t%.*s\n", instructions[opcode], index, val.length, val.text);
     offset += 1;
 }
 
-void get_locals(OpCode opcode, i32_t &offset) {
+void Compiler::get_locals(OpCode opcode, i32_t &offset) {
     auto index = get_double_byte_index(offset);
     std::fprintf(stderr, "%20s\t%4d\n", instructions[opcode], index);
     offset += 1;
 }
 
-void disassemble_instruction(i32_t &offset) {
+void Compiler::disassemble_instruction(i32_t &offset) {
     std::fprintf(stderr, "%04d\t%4d\t", offset, lines.at(offset));
     switch (code.at(offset)) {
         case int_c:
-            three_byte_instruction(int_c, ++offset);
+            five_byte_instruction(int_c, ++offset);
             break;
         case char_c:
-            three_byte_instruction(char_c, ++offset);
+            five_byte_instruction(char_c, ++offset);
             break;
         case double_c:
-            three_byte_instruction(double_c, ++offset);
+            five_byte_instruction(double_c, ++offset);
             break;
         case string_c:
-            three_byte_instruction(string_c, ++offset);
+            five_byte_instruction(string_c, ++offset);
+            break;
+        case int_i:
+            immediate_instruction(int_i, ++offset);
             break;
         case add:
             single_byte_instruction(add);
@@ -999,27 +1867,16 @@ void disassemble_instruction(i32_t &offset) {
         case ipop:
             single_byte_instruction(ipop);
             break;
-        case ipush_bp:
-            single_byte_instruction(ipush_bp);
-            break;
-        case ipop_bp:
-            single_byte_instruction(ipop_bp);
+        case enter:
+            single_byte_instruction(enter);
             break;
-        case ret_addr:
-            jump_true_false_instruction(ret_addr, ++offset);
-            break;
-        case push_arg_addr:
-            std::fprintf(stderr,"%20s\t%4d\n", instructions[push_arg_addr],
-                    argument_indexes.at(get_double_byte_index(++offset)));
-            offset += 1;
-            break;
-        case pop_arg_addr:
-            std::fprintf(stderr,"%20s\t%4d\n", instructions[pop_arg_addr], get_double_byte_index(++offset));
-            offset += 1;
-            break;
-        case set_arg_addr:
-            std::fprintf(stderr,"%20s\t%4d\n", instructions[set_arg_addr], get_double_byte_index(++offset));
-            offset += 1;
+        case call:
+            {
+                auto index = get_quad_byte_index(++offset);
+                offset += 4;
+                std::fprintf(stderr, "%20s\t%4d\t%15s\t%4u\n", instructions[call], index, instructions[code.at(index)],
+                        code.at(offset));
+            }
             break;
         case print:
             double_byte_instruction(print, ++offset);
@@ -1107,12 +1964,6 @@ void disassemble_instruction(i32_t &offset) {
         case set_local:
             get_locals(set_local, ++offset);
             break;
-        case store_ret_value:
-            single_byte_instruction(store_ret_value);
-            break;
-        case load_ret_value:
-            single_byte_instruction(load_ret_value);
-            break;
         case load_local_ref:
             std::fprintf(stderr, "%20s\t%4d\n", instructions[load_local_ref], get_double_byte_index(++offset));
             offset += 1;
@@ -1221,78 +2072,395 @@ void disassemble_instruction(i32_t &offset) {
     }
 }
 
-void disassemble_code(char const *part) {
+void Compiler::disassemble_code(char const *part) {
     std::fprintf(stderr, "======== %s =========\n", part);
 
     for (i32_t offset = 0; offset < as_t<i32_t>(code.size()); ++offset)
         disassemble_instruction(offset);
 }
 
-void emit_single_byte(u8_t byte, i32_t _line = cur_token.line) {
+void Compiler::emit_single_byte(u8_t byte, i32_t _line) {
     code.push_back(byte);
-    lines.push_back(_line);
+    lines.push(_line);
 }
 
-void emit_double_byte(u8_t byte1, u8_t byte2, i32_t _line = cur_token.line) {
+void Compiler::emit_double_byte(u8_t byte1, u8_t byte2, i32_t _line) {
     emit_single_byte(byte1);
     emit_single_byte(byte2);
 }
 
-void emit_value(OpCode op, Value val, i32_t _line = cur_token.line) {
+/* the key a constant is kept under in the pool, its kind and its bytes.
+ * strings are told apart by their text, not by where it is */
+std::string constant_key(Value val) {
+    std::string key(1, as_t<char>(val.kind()));
+    auto append = [&key](auto bytes) {
+        key.append(reinterpret_cast<char const *>(&bytes), sizeof(bytes));
+    };
+    switch (val.kind()) {
+        case Int_v: append(val.as_int()); break;
+        case Char_v: append(val.as_char()); break;
+        case Bool_v: append(val.as_boolean()); break;
+        case Double_v: append(val.as_double()); append(val.precision()); break;
+        case String_v: key.append(val.as_string().text, val.as_string().length); break;
+        case Nil_v: break;
+    }
+    return key;
+}
+
+/* index of val in values, which only gets a new entry for a constant it
+ * does not have yet */
+i32_t Compiler::intern_constant(Value val) {
+    for ( ; constants_indexed < i32_t(values.size()); ++constants_indexed)
+        constant_indexes.try_emplace(constant_key(values[constants_indexed]), constants_indexed);
+
+    auto [found, inserted] = constant_indexes.try_emplace(constant_key(val), i32_t(values.size()));
+    if (inserted) {
+        values.push_back(val);
+        ++constants_indexed;
+    }
+    return found->second;
+}
+
+/* integers that fit in 32 bits go into the operand instead of the pool */
+void Compiler::emit_value(OpCode op, Value val, i32_t _line) {
+    i32_t operand;
+    if (op == int_c && val.as_int() >= INT32_MIN && val.as_int() <= INT32_MAX) {
+        op = int_i;
+        operand = as_t<i32_t>(val.as_int());
+    } else {
+        operand = intern_constant(val);
+    }
+
     emit_single_byte(op, _line);
-    values.push_back(val);
+    for (i32_t shift = 24; shift >= 0; shift -= 8)
+        emit_single_byte(as_t<u8_t>(operand >> shift), _line);
+}
 
-    auto index = as_t<u16_t>(values.size() - 1);
+void Compiler::emit_three_bytes(OpCode op, i16_t index, i32_t _line) {
+    emit_single_byte(op, _line);
     emit_single_byte(as_t<u8_t>(index >> 8), _line);
     emit_single_byte(as_t<u8_t>(index), _line);
 }
 
-void emit_three_bytes(OpCode op, i16_t index, i32_t _line = cur_token.line) {
+/* jumps to an address that is already known */
+void Compiler::emit_five_bytes(OpCode op, i32_t address, i32_t _line) {
     emit_single_byte(op, _line);
-    emit_single_byte(as_t<u8_t>(index >> 8), _line);
-    emit_single_byte(as_t<u8_t>(index), _line);
+    for (i32_t shift = 24; shift >= 0; shift -= 8)
+        emit_single_byte(as_t<u8_t>(address >> shift), _line);
 }
 
-void emit_jump(OpCode op, i32_t _line = cur_token.line) {
+/* jumps forward, set_correct_code_address() fills in the address later */
+void Compiler::emit_jump(OpCode op, i32_t _line) {
     emit_single_byte(op, _line);
-    emit_single_byte(0xff, _line);
-    emit_single_byte(0xff, _line);
+    for (i32_t i = 0; i < 4; ++i)
+        emit_single_byte(0xff, _line);
 }
 
-void emit_array_indexing(OpCode op, i16_t index, u8_t count, i32_t _line = cur_token.line) {
+void Compiler::emit_array_indexing(OpCode op, i16_t index, u8_t count, i32_t _line) {
     emit_single_byte(op, _line);
     emit_double_byte(as_t<u8_t>(index >> 8), as_t<u8_t>(index), _line);
     emit_single_byte(count, _line);
 }
 
-void set_correct_code_address(i16_t index, i32_t offset) {
-    code.at(offset - 2) &= as_t<u8_t>(index >> 8);
-    code.at(offset - 1) &= as_t<u8_t>(index);
+void Compiler::set_correct_code_address(i32_t index, i32_t offset) {
+    for (i32_t i = 1; i <= 4; ++i)
+        code.at(offset - i) &= as_t<u8_t>(index >> (8 * (i - 1)));
+    last_jump_target = std::max(last_jump_target, index);
 }
 
-i64_t to_i64(char const *text, i32_t length) {
-    i64_t ret = 0;
-    for (i32_t i = 0; i < length; ++i) {
-        ret = ret * 10 + (text[i] - '0');
-    }
+/* drops everything code has from size on */
+void Compiler::truncate_code(i32_t size) {
+    code.resize(size);
+    lines.resize(size);
+    while (!constant_pushes.empty() && constant_pushes.back().end > size)
+        constant_pushes.pop_back();
+    if (return_end > size)
+        return_end = -1;
+    last_jump_target = std::min(last_jump_target, size);
+}
 
-    return ret;
+u8_t operand_bytes(OpCode op);
+bool is_code_address(OpCode op);
+
+/* code that has to run later than where it is written, like the increment
+ * of a for loop, is compiled where it is parsed and cut out of code again */
+struct CapturedCode {
+    i32_t start;
+    vector<u8_t> code;
+    vector<i32_t> lines;
+};
+
+CapturedCode Compiler::capture_code(i32_t start) {
+    CapturedCode captured{start, {code.begin() + start, code.end()}, {}};
+    for (i32_t offset = start; offset < lines.size(); ++offset)
+        captured.lines.push_back(lines.at(offset));
+    truncate_code(start);
+    return captured;
 }
 
-Fraction to_double(char const *text, i32_t length) {
-    double ret = 0;
-    i8_t fraction_count = 0;
-    bool flag = false;
-    for (i32_t i = 0; i < length; ++i) {
-        if (text[i] == '.') {
-            flag = true;
+/* puts captured code back at the end of code. jumps and return addresses
+ * into the captured code move along with it */
+void Compiler::emit_captured(CapturedCode const &captured) {
+    i32_t end = captured.start + captured.code.size();
+    i32_t moved_by = code.size() - captured.start;
+    i32_t offset = code.size();
+    code.insert(code.end(), captured.code.begin(), captured.code.end());
+    for (auto line : captured.lines)
+        lines.push(line);
+
+    for ( ; offset < i32_t(code.size()); offset += 1 + operand_bytes(OpCode(code[offset]))) {
+        if (!is_code_address(OpCode(code[offset])))
             continue;
-        }
+        auto address = get_quad_byte_index(offset + 1);
+        if (address < captured.start || address > end)
+            continue;
+        address += moved_by;
+        last_jump_target = std::max(last_jump_target, address);
+        for (i32_t i = 0; i < 4; ++i)
+            code[offset + 1 + i] = as_t<u8_t>(address >> (24 - 8 * i));
+    }
+}
 
-        if (fraction_count >= 10)
-            break;
+/* where the last n constant pushes start in constant_pushes, or -1 if code
+ * does not end with them or a jump lands between them */
+i32_t Compiler::trailing_constants(i32_t n) {
+    auto first = i32_t(constant_pushes.size()) - n;
+    if (first < 0)
+        return -1;
 
-        if (flag)
+    i32_t end = code.size();
+    for (auto i = i32_t(constant_pushes.size()) - 1; i >= first; --i) {
+        if (constant_pushes[i].end != end)
+            return -1;
+        end = constant_pushes[i].start;
+    }
+    return last_jump_target > end ? -1 : first;
+}
+
+void Compiler::emit_constant(Value val, i32_t _line) {
+    i32_t start = code.size();
+    switch (val.kind()) {
+        case Int_v: emit_value(int_c, val, _line); break;
+        case Double_v: emit_value(double_c, val, _line); break;
+        case Char_v: emit_value(char_c, val, _line); break;
+        case String_v: emit_value(string_c, val, _line); break;
+        case Bool_v: emit_single_byte(val.as_boolean() ? true_l : false_l, _line); break;
+        case Nil_v: emit_single_byte(nil, _line); break;
+    }
+    constant_pushes.push_back({start, i32_t(code.size()), val});
+}
+
+/* what == gives for two values of the same kind, in every vm and in the
+ * compiler's folding alike */
+inline bool same_value(Value a, Value b) {
+    switch (a.kind()) {
+        case Int_v: return a.as_int() == b.as_int();
+        case Char_v: return a.as_char() == b.as_char();
+        case Double_v: return std::fabs(a.as_double() - b.as_double()) == 0.0;
+        case Bool_v: return a.as_boolean() == b.as_boolean();
+        case String_v:
+            return a.as_string().length == b.as_string().length &&
+                std::memcmp(a.as_string().text, b.as_string().text, a.as_string().length) == 0;
+        case Nil_v: return true;
+    }
+    return false;
+}
+
+/* what op leaves on the stack for constant operands, worked out the way
+ * the runtime does it. operands the runtime stops at with an error and
+ * integer division by zero are left for the runtime */
+bool fold_binary(OpCode op, Value a, Value b, Value &result) {
+    if (a.kind() != b.kind())
+        return false;
+
+    switch (op) {
+        case add:
+        case sub:
+        case mult:
+            if (a.is_int()) {
+                /* wraps around like the runtime does, without the overflow */
+                u64_t x = a.as_int(), y = b.as_int();
+                result = as_t<i64_t>(op == add ? x + y : op == sub ? x - y : x * y);
+            } else if (a.is_double()) {
+                auto x = a.as_double(), y = b.as_double();
+                result = (op == add ? x + y : op == sub ? x - y : x * y);
+            } else {
+                return false;
+            }
+            return true;
+        case idiv:
+        case mod:
+            if (a.is_int()) {
+                if (b.as_int() == 0 || (b.as_int() == -1 && a.as_int() == INT64_MIN))
+                    return false;
+                result = (op == idiv ? a.as_int() / b.as_int() : a.as_int() % b.as_int());
+            } else if (a.is_double()) {
+                auto x = a.as_double(), y = b.as_double();
+                result = (op == idiv ? x / y : std::fmod(x, y));
+            } else {
+                return false;
+            }
+            return true;
+        case lt:
+        case lte:
+        case gt:
+        case gte:
+            if (a.is_int()) {
+                auto x = a.as_int(), y = b.as_int();
+                result = (op == lt ? x < y : op == lte ? x <= y : op == gt ? x > y : x >= y);
+            } else if (a.is_char()) {
+                auto x = a.as_char(), y = b.as_char();
+                result = (op == lt ? x < y : op == lte ? x <= y : op == gt ? x > y : x >= y);
+            } else if (a.is_double()) {
+                auto x = a.as_double(), y = b.as_double();
+                result = (op == lt ? std::isless(x, y) : op == lte ? std::islessequal(x, y) :
+                        op == gt ? std::isgreater(x, y) : std::isgreaterequal(x, y));
+            } else {
+                return false;
+            }
+            return true;
+        case eq:
+        case neq:
+            result = (op == eq ? same_value(a, b) : !same_value(a, b));
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool fold_unary(OpCode op, Value a, Value &result) {
+    switch (op) {
+        case positive:
+            result = a;
+            return a.is_int();
+        case neg:
+            if (!a.is_int())
+                return false;
+            result = as_t<i64_t>(0 - as_t<u64_t>(a.as_int()));
+            return true;
+        case inot:
+            result = !a.as_bool();
+            return true;
+        case cast_to_int:
+            if (a.is_int())
+                result = a;
+            else if (a.is_bool())
+                result = as_t<i64_t>(a.as_bool() ? 1 : 0);
+            else if (a.is_double() && std::fabs(a.as_double()) < 9.2e18)
+                result = as_t<i64_t>(a.as_double());
+            else if (a.is_char())
+                result = as_t<i64_t>(a.as_char());
+            else if (a.is_nil())
+                result = as_t<i64_t>(0);
+            else
+                return false;
+            return true;
+        case cast_to_double:
+            if (a.is_double())
+                result = a;
+            else if (a.is_int())
+                result = as_t<double>(a.as_int());
+            else if (a.is_bool())
+                result = as_t<double>(a.as_bool() ? 1 : 0);
+            else if (a.is_char())
+                result = as_t<double>(a.as_char());
+            else if (a.is_nil())
+                result = 0.0;
+            else
+                return false;
+            return true;
+        case cast_to_char:
+            if (a.is_char())
+                result = a;
+            else if (a.is_int())
+                result = as_t<char>(a.as_int());
+            else if (a.is_double() && a.as_double() > -129.0 && a.as_double() < 128.0)
+                result = as_t<char>(a.as_double());
+            else if (a.is_nil())
+                result = '\0';
+            else
+                return false;
+            return true;
+        case cast_to_bool:
+            result = a.as_bool();
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* an operator over constants is replaced by the constant it makes */
+void Compiler::emit_binary(OpCode op, i32_t _line) {
+    Value result;
+    auto first = trailing_constants(2);
+    if (first >= 0 && fold_binary(op, constant_pushes[first].val, constant_pushes[first + 1].val, result)) {
+        truncate_code(constant_pushes[first].start);
+        emit_constant(result, _line);
+        return;
+    }
+    emit_single_byte(op, _line);
+}
+
+void Compiler::emit_unary(OpCode op, i32_t _line) {
+    Value result;
+    auto first = trailing_constants(1);
+    if (first >= 0 && fold_unary(op, constant_pushes[first].val, result)) {
+        truncate_code(constant_pushes[first].start);
+        emit_constant(result, _line);
+        return;
+    }
+    emit_single_byte(op, _line);
+}
+
+/* left && right and left || right once right is compiled after the jump,
+ * when left is a constant. a left that decides the result is all that
+ * stays, otherwise the result is right as a bool */
+void Compiler::fold_short_circuit(ConstantPush left, i32_t right_start, bool decided_by) {
+    if (left.val.as_bool() == decided_by) {
+        truncate_code(left.end);
+        return;
+    }
+
+    /* the logical operator at the end goes, right is moved to where left was */
+    if (!constant_pushes.empty() && constant_pushes.back().start == right_start &&
+            constant_pushes.back().end == i32_t(code.size()) - 1) {
+        auto right = constant_pushes.back();
+        truncate_code(left.start);
+        emit_constant(right.val.as_bool());
+        return;
+    }
+
+    auto captured = capture_code(right_start);
+    captured.code.pop_back();
+    captured.lines.pop_back();
+    truncate_code(left.start);
+    emit_captured(captured);
+    emit_unary(cast_to_bool);
+}
+
+i64_t to_i64(char const *text, i32_t length) {
+    i64_t ret = 0;
+    for (i32_t i = 0; i < length; ++i) {
+        ret = ret * 10 + (text[i] - '0');
+    }
+
+    return ret;
+}
+
+Fraction to_double(char const *text, i32_t length) {
+    double ret = 0;
+    i8_t fraction_count = 0;
+    bool flag = false;
+    for (i32_t i = 0; i < length; ++i) {
+        if (text[i] == '.') {
+            flag = true;
+            continue;
+        }
+
+        if (fraction_count >= 10)
+            break;
+
+        if (flag)
             ++fraction_count;
         ret = ret * 10 + (text[i] - '0');
     }
@@ -1370,8 +2538,8 @@ bool get_double(double &n) {
     return true;
 }
 
-void print_error_line(int offset, char const *_text = text) {
-    auto &error_line = sourcecode.at(offset);
+void Compiler::print_error_line(int offset, char const *_text) {
+    auto &error_line = source_line(offset);
     auto len = _text - error_line.text;
     std::fprintf(stderr, BOLD_GREEN "\t%4d" NORMAL "| ", offset + 1);
     for (i32_t i = 0; i < error_line.length; ++i) {
@@ -1393,7 +2561,7 @@ void error_header(i32_t line) {
     std::fprintf(stderr, "[line:%d] " BOLD_RED "error" NORMAL ": ", line);
 }
 
-void erroneous_token(char const *tok, i32_t length) {
+void Compiler::erroneous_token(char const *tok, i32_t length) {
     if (source_index >= source_length) {
         std::fprintf(stderr, "'" BOLD_RED "%.*s'eof'" NORMAL "'\n", length, tok);
         return;
@@ -1431,11 +2599,33 @@ void erroneous_token(char const *tok, i32_t length) {
 
 /* lexer start */
 
-inline bool is_eof() {
+/* what each byte can be a part of, looked up instead of asking <cctype> */
+constexpr u8_t digit_char = 1;
+constexpr u8_t identifier_char = 2;     /* letters, digits and '_' */
+
+constexpr std::array<u8_t, 256> char_classes = [] {
+    std::array<u8_t, 256> classes{};
+    for (i32_t c = '0'; c <= '9'; ++c)
+        classes[c] = digit_char | identifier_char;
+    for (i32_t c = 'a'; c <= 'z'; ++c)
+        classes[c] = classes[c - 'a' + 'A'] = identifier_char;
+    classes['_'] = identifier_char;
+    return classes;
+}();
+
+inline bool is_digit(char c) {
+    return char_classes[u8_t(c)] & digit_char;
+}
+
+inline bool is_identifier_char(char c) {
+    return char_classes[u8_t(c)] & identifier_char;
+}
+
+inline bool Compiler::is_eof() {
     return source_index >= source_length; 
 }
 
-char eat_c() {
+char Compiler::eat_c() {
     if (is_eof())
         return '\0';
 
@@ -1443,20 +2633,20 @@ char eat_c() {
     return source[source_index++];
 }
 
-char peek_c() {
+char Compiler::peek_c() {
     if (is_eof())
         return '\0';
     return source[source_index];
 }
 
-char peek_next_c() {
+char Compiler::peek_next_c() {
     if (is_eof())
         return '\0';
     return source[source_index + 1];
 }
 
 
-void error_token(char const *message, char const *_text = text, i32_t _line = line) {
+void Compiler::error_token(char const *message, char const *_text, i32_t _line) {
     compile_error = true;
     error_header(line);
     std::fprintf(stderr, "%s: ", message);
@@ -1464,31 +2654,107 @@ void error_token(char const *message, char const *_text = text, i32_t _line = li
     print_error_line(_line - 1, _text);
 }
 
-void unterminated_string(char const *text, i32_t _line = line) {
+void Compiler::unterminated_string(char const *text, i32_t _line) {
     error_token("unterminated string", text, _line);
     std::fprintf(stderr, BOLD_PURBLE "NOTE" NORMAL ": expected '" BOLD_GREEN "\"" NORMAL 
                         "' at the end of the string\n\n");
 }
 
-void unterminated_print_argument() {
+void Compiler::unterminated_print_argument() {
     error_token("unterminated print argument");
     std::fprintf(stderr, BOLD_PURBLE "NOTE" NORMAL ": expected '" BOLD_GREEN "}" NORMAL 
                         "' at the end of expression\n\n");
 }
 
-void empty_print_argument(char const *text, i32_t _line = line) {
+void Compiler::empty_print_argument(char const *text, i32_t _line) {
     error_token("empty print argument", text, _line);
     std::fprintf(stderr, BOLD_PURBLE "NOTE" NORMAL ": expected expression after '{'\n\n");
 }
 
 
-void skip_whitespace(bool save_line = true) {
+void Compiler::skip_to(i32_t index) {
+    text_len += index - source_index;
+    source_index = index;
+}
+
+#if NCC_SIMD_LEXER
+/* bit i of the result is set when byte i of the 16 at index is one of
+ * the stop bytes */
+template <typename... Stops>
+u32_t Compiler::stop_mask(i32_t index, Stops... stops) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(source + index));
+    auto found = _mm_setzero_si128();
+    ((found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(stops)))), ...);
+    return _mm_movemask_epi8(found);
+}
+#endif
+
+/* the scans below look at the source 16 bytes at a time and may read up to
+ * 15 bytes past its end, read_file() pads it with zeros for them. they all
+ * stop at a '\0', so they never run past the end of the source */
+
+/* first byte from index on that is not a space or a tab */
+i32_t Compiler::skip_blanks(i32_t index) {
+#if NCC_SIMD_LEXER
+    while (true) {
+        u32_t blanks = stop_mask(index, ' ', '\t');
+        if (blanks != 0xffff)
+            return index + __builtin_ctz(~blanks);
+        index += 16;
+    }
+#else
+    while (source[index] == ' ' || source[index] == '\t')
+        ++index;
+    return index;
+#endif
+}
+
+/* the '\n' ending the line index is on, or the end of the source */
+i32_t Compiler::find_line_end(i32_t index) {
+    while (true) {
+#if NCC_SIMD_LEXER
+        u32_t stops = stop_mask(index, '\n', '\0');
+        if (!stops) {
+            index += 16;
+            continue;
+        }
+        index += __builtin_ctz(stops);
+#else
+        while (source[index] != '\n' && source[index] != '\0')
+            ++index;
+#endif
+        if (source[index] == '\n' || index >= source_length)
+            return index;
+        ++index;    /* a '\0' in a comment */
+    }
+}
+
+/* first byte from index on that string_token() has to look at */
+i32_t Compiler::find_string_special(i32_t index) {
+#if NCC_SIMD_LEXER
+    while (true) {
+        u32_t stops = stop_mask(index, '"', '\n', '{', '\\', '\0');
+        if (stops)
+            return index + __builtin_ctz(stops);
+        index += 16;
+    }
+#else
+    while (source[index] != '"' && source[index] != '\n' && source[index] != '{'
+            && source[index] != '\\' && source[index] != '\0')
+        ++index;
+    return index;
+#endif
+}
+
+void Compiler::skip_whitespace(bool save_line) {
     while (true) {
         switch (peek_c()) {
-            case '\n':
-                ++line;
             case ' ':
             case '\t':
+                skip_to(skip_blanks(source_index));
+                continue;
+            case '\n':
+                ++line;
             case '\v':
             case '\r':
             case '\f':
@@ -1497,8 +2763,7 @@ void skip_whitespace(bool save_line = true) {
                 break;
             case '/':
                 if (peek_next_c() == '/') {
-                    while (peek_c() != '\n' && !is_eof())
-                        eat_c();
+                    skip_to(find_line_end(source_index));
                     continue;
                 }
                 return;
@@ -1509,14 +2774,14 @@ void skip_whitespace(bool save_line = true) {
     }
 }
 
-TokenKind number_token() {
-    while (std::isdigit(peek_c()) && !is_eof()) {
+TokenKind Compiler::number_token() {
+    while (is_digit(peek_c()) && !is_eof()) {
         eat_c();
     }
 
     if (peek_c() == '.') {
         eat_c();
-        while (std::isdigit(peek_c()) && !is_eof()) {
+        while (is_digit(peek_c()) && !is_eof()) {
             eat_c();
         }
 
@@ -1534,7 +2799,7 @@ bool is_escape_char(char c) {
     return !(c != 'a' && c != 'b' && c != 'n' && c != 'r' && c != 't' && c != '\\' && c != '\'' && c != '"' && c != '0');
 }
 
-TokenKind char_token(bool print_error = true) {
+TokenKind Compiler::char_token(bool print_error) {
     TokenKind kind = Character;
     if (peek_c() == '\\') {
         eat_c();
@@ -1582,11 +2847,15 @@ TokenKind char_token(bool print_error = true) {
     return kind;
 }
 
-TokenKind string_token(bool print_error = true) {
+TokenKind Compiler::string_token(bool print_error) {
     auto save_text = text;
     auto save_line = line;
     TokenKind kind = String;
     while (peek_c() != '"' && !is_eof()) {
+        skip_to(find_string_special(source_index));
+        if (peek_c() == '"' || is_eof())
+            break;
+
         if (peek_c() == '\n') {
             auto save_text2 = text + text_len - 1;
             auto save_line2 = line;
@@ -1667,96 +2936,73 @@ TokenKind string_token(bool print_error = true) {
     return String;
 }
 
-TokenKind identifier_token() {
-    while (std::isalnum(peek_c()) || peek_c() == '_' && !is_eof())
-        eat_c();
+struct Keyword {
+    char const *name;
+    i32_t length;
+    TokenKind kind;
+};
+
+constexpr Keyword keywords[] = {
+    {"else", 4, Else}, {"elif", 4, Elif}, {"nil", 3, Nil}, {"true", 4, True},
+    {"func", 4, Func}, {"false", 5, False}, {"for", 3, For}, {"print", 5, Print},
+    {"var", 3, Var}, {"if", 2, If}, {"int_t", 5, Int_t}, {"input", 5, Input},
+    {"while", 5, While}, {"return", 6, Return}, {"getc", 4, Get_C}, {"geti", 4, Get_I},
+    {"gets", 4, Get_S}, {"getd", 4, Get_D}, {"string", 6, String_Type},
+    {"double_t", 8, Double_t}, {"char_t", 6, Char_t}, {"bool_t", 6, Bool_t},
+};
+
+/* the first, middle and last character and the length tell every keyword
+ * apart, so a keyword is found with a single table lookup and compare */
+constexpr i32_t keyword_table_size = 32;
+constexpr i32_t max_keyword_length = 8;
+
+constexpr u32_t keyword_hash(char const *text, i32_t length) {
+    return (u8_t(text[0]) * 2 + u8_t(text[length - 1]) * 19 + u8_t(text[length / 2]) * 20 + length)
+        % keyword_table_size;
+}
+
+constexpr std::array<Keyword, keyword_table_size> keyword_table = [] {
+    std::array<Keyword, keyword_table_size> table{};
+    for (auto &keyword : keywords)
+        table[keyword_hash(keyword.name, keyword.length)] = keyword;
+    return table;
+}();
+
+constexpr bool keyword_table_is_perfect() {
+    for (auto &keyword : keywords) {
+        if (keyword_table[keyword_hash(keyword.name, keyword.length)].kind != keyword.kind)
+            return false;
+    }
+    return true;
+}
+
+static_assert(keyword_table_is_perfect(), "two keywords hash to the same slot, change keyword_hash()");
+
+TokenKind Compiler::identifier_token() {
+    auto end = source_index;
+    while (end < source_length && is_identifier_char(source[end]))
+        ++end;
+    text_len += end - source_index;
+    source_index = end;
+
     TokenKind kind = Identifier;
-    switch (*text) {
-        case 'e':
-            if (text_len == 4 && std::strncmp(text+1, "lse", 3) == 0)
-                kind = Else;
-            else if (text_len == 4 && std::strncmp(text+1, "lif", 3) == 0)
-                kind = Elif;
-            break;
-        case 'n':
-            if (text_len == 3 && std::strncmp(text+1, "il", 2) == 0)
-                kind = Nil;
-            break;
-        case 't':
-            if (text_len == 4 && std::strncmp(text+1, "rue", 3) == 0)
-                kind = True;
-            break;
-        case 'f':
-            if (text_len == 4 && std::strncmp(text+1, "unc", 3) == 0)
-                kind = Func;
-            else if (text_len == 5 && std::strncmp(text+1, "alse", 4) == 0)
-                kind = False;
-            else if (text_len == 3 && std::strncmp(text+1, "or", 2) == 0)
-                kind = For;
-            break;
-        case 'p':
-            if (text_len == 5 && std::strncmp(text+1, "rint", 4) == 0)
-                kind = Print;
-            break;
-        case 'v':
-            if (text_len == 3 && std::strncmp(text+1, "ar", 2) == 0)
-                kind = Var;
-            break;
-        case 'i':
-            if (text_len == 2 && *(text+1) == 'f')
-                kind = If;
-            else if (text_len == 5 && std::strncmp(text+1, "nt_t", 4) == 0)
-                kind = Int_t;
-            else if (text_len == 5 && std::strncmp(text+1, "nput", 4) == 0)
-                kind = Input;
-            break;
-        case 'w':
-            if (text_len == 5 && std::strncmp(text+1, "hile", 4) == 0)
-                kind = While;
-            break;
-        case 'r':
-            if (text_len == 6 && std::strncmp(text+1, "eturn", 5) == 0)
-                kind = Return;
-            break;
-        case 'g':
-            if (text_len == 4 && std::strncmp(text+1, "etc", 3) == 0)
-                kind = Get_C;
-            else if (text_len == 4 && std::strncmp(text+1, "eti", 3) == 0)
-                kind = Get_I;
-            else if (text_len == 4 && std::strncmp(text+1, "ets", 3) == 0)
-                kind = Get_S;
-            else if (text_len == 4 && std::strncmp(text+1, "etd", 3) == 0)
-                kind = Get_D;
-            break;
-        case 's':
-            if (text_len == 6 && std::strncmp(text+1, "tring", 5) == 0)
-                kind = String_Type;
-            break;
-        case 'd':
-            if (text_len == 8 && std::strncmp(text+1, "ouble_t", 7) == 0)
-                kind = Double_t;
-            break;
-        case 'c':
-            if (text_len == 6 && std::strncmp(text+1, "har_t", 5) == 0)
-                kind = Char_t;
-            break;
-        case 'b':
-            if (text_len == 6 && std::strncmp(text+1, "ool_t", 5) == 0)
-                kind = Bool_t;
-            break;
-        default:
-            break;
+    if (text_len <= max_keyword_length) {
+        auto &keyword = keyword_table[keyword_hash(text, text_len)];
+        if (keyword.length == text_len && std::memcmp(keyword.name, text, text_len) == 0)
+            kind = keyword.kind;
     }
 
     if (kind == Identifier && peek_c() == '(')
         kind = FuncIdentifier;
+    if (kind == Identifier || kind == FuncIdentifier)
+        identifiers.intern(text, text_len);
     
     cur_token._kind = kind;
     cur_token.line = line;
     return kind;
 }
 
-TokenKind gettoken(bool save_line = true) {
+TokenKind Compiler::lex_token(bool save_line) {
     skip_whitespace(save_line); 
     text = source + source_index;
     text_len = 0;
@@ -1845,9 +3091,9 @@ TokenKind gettoken(bool save_line = true) {
           break;
         case '\'': return char_token(save_line);
         default:
-           if (std::isdigit(c)) {
+           if (is_digit(c)) {
                return number_token();
-           } else if (std::isalnum(c) || c == '_') {
+           } else if (is_identifier_char(c)) {
                return identifier_token();
            }
            kind = Unrecognized;
@@ -1861,7 +3107,41 @@ TokenKind gettoken(bool save_line = true) {
     return kind;
 }
 
-TokenKind peek_token(bool save_cur = true, int count = 0) {
+/* the parser peeks at the same tokens again and again and rewinds the
+ * source for print arguments and for loop increments, so every token that
+ * was lexed is remembered by where lexing started. lexing only depends on
+ * that position and the line, so a hit gives the same token without going
+ * through the characters again. this is a direct mapped cache, a token
+ * only pushes out one that started a multiple of its size away. the
+ * parser's lookahead stays within a few tokens, so the cache gets nearly
+ * every hit an array of all the tokens of the file would, without the
+ * second pass over the source or the memory that grows with it */
+
+TokenKind Compiler::gettoken(bool save_line) {
+    auto &lexeme = token_cache[source_index % token_cache_size];
+    if (lexeme.start == source_index && lexeme.start_line == line) {
+        text = source + lexeme.offset;
+        text_len = lexeme.length;
+        source_index = lexeme.end;
+        line = lexeme.line;
+        cur_token._kind = lexeme.kind;
+        cur_token.line = line;
+        return lexeme.kind;
+    }
+
+    auto start = source_index;
+    auto start_line = line;
+    auto kind = lex_token(save_line);
+
+    /* erroneous tokens are lexed again so their errors get printed once
+     * they are taken, a string running into the end of the file is only an
+     * error when it is taken too */
+    if (cur_token._kind != Error && cur_token._kind != Unrecognized && !(kind == String && is_eof()))
+        lexeme = {start, start_line, i32_t(text - source), text_len, source_index, line, kind};
+    return kind;
+}
+
+TokenKind Compiler::peek_token(bool save_cur, int count) {
     if (is_eof())
         return Eof;
     auto save_text = text;
@@ -1885,7 +3165,7 @@ TokenKind peek_token(bool save_cur = true, int count = 0) {
     return ret;
 }
 
-bool match_token(TokenKind kind) {
+bool Compiler::match_token(TokenKind kind) {
     if (peek_token() == kind) {
         return gettoken() == kind;
     }
@@ -1896,7 +3176,7 @@ bool match_token(TokenKind kind) {
 
 /* parser start */
 
-void unexpected_token(char const *expected, Token &tok) {
+void Compiler::unexpected_token(char const *expected, Token &tok) {
     parse_error = true;
     error_header(tok.line);
     std::fprintf(stderr, "expected '" BOLD_GREEN "%s" NORMAL "', found ", expected);
@@ -1904,7 +3184,7 @@ void unexpected_token(char const *expected, Token &tok) {
     print_error_line(tok.line - 1);
 }
 
-void expected_expression(Token &tok) {
+void Compiler::expected_expression(Token &tok) {
     parse_error = true;
     error_header(tok.line);
     std::fprintf(stderr, "expected expression, found ");
@@ -1912,7 +3192,7 @@ void expected_expression(Token &tok) {
     print_error_line(tok.line - 1);
 }
 
-void redefining_variable(char const *text, i32_t length, i32_t _line = line) {
+void Compiler::redefining_variable(char const *text, i32_t length, i32_t _line) {
     parse_error = true;
     error_header(_line);
     std::fprintf(stderr, "redefining variable in the same scope ");
@@ -1920,7 +3200,7 @@ void redefining_variable(char const *text, i32_t length, i32_t _line = line) {
     print_error_line(_line, text);
 }
 
-void redefining_function(char const *text, i32_t length, i32_t _line = line) {
+void Compiler::redefining_function(char const *text, i32_t length, i32_t _line) {
     parse_error = true;
     error_header(_line);
     std::fprintf(stderr, "redefining function ");
@@ -1928,7 +3208,7 @@ void redefining_function(char const *text, i32_t length, i32_t _line = line) {
     print_error_line(_line, text);
 }
 
-void undefined_reference(char const *_text = text, i32_t _length = text_len, i32_t _line = line) {
+void Compiler::undefined_reference(char const *_text, i32_t _length, i32_t _line) {
     parse_error = true;
     error_header(_line);
     std::fprintf(stderr, "undefined reference to ");
@@ -1936,7 +3216,7 @@ void undefined_reference(char const *_text = text, i32_t _length = text_len, i32
     print_error_line(_line - 1);
 }
 
-void consume(TokenKind kind) {
+void Compiler::consume(TokenKind kind) {
     auto ret = gettoken() == kind;
     if (!ret) {
         unexpected_token(tokens[kind], cur_token);
@@ -1944,7 +3224,7 @@ void consume(TokenKind kind) {
     }
 }
 
-void synchronize() {
+void Compiler::synchronize() {
     while (true) {
         auto tok = peek_token(false);
         switch (tok) {
@@ -2020,9 +3300,6 @@ i8_t binary_operator_precedence(TokenKind kind) {
     }
 }
 
-void parse_assignment(i8_t parentPrecedence = 0);
-void parse_expression(i8_t parentPrecedence = 0);
-
 char escape_character(char d) {
     switch (d) {
         case 'a': return '\a';
@@ -2038,11 +3315,15 @@ char escape_character(char d) {
         case '0': return '\0';
     }
 
-    error_token("invalid escape sequence");
+    /* the lexer keeps any other escape out of literals */
     return '\0';
 }
 
-i16_t index_of(char const *text, i32_t length, bool &is_global, bool &reference, u8_t &count, bool &is_string) {
+/* what index_of() returns for a name that is not a variable. -1 is the
+ * last argument of a function */
+constexpr i16_t no_index = INT16_MIN;
+
+i16_t Compiler::index_of(char const *text, i32_t length, bool &is_global, bool &reference, u8_t &count, bool &is_string) {
     i32_t index;
     is_global = false;
     reference = false;
@@ -2052,13 +3333,13 @@ i16_t index_of(char const *text, i32_t length, bool &is_global, bool &reference,
     }
 
     if (!globals2.contains({text, length}, index))
-        return -1;
+        return no_index;
     
     is_global = true;
     return index;
 }
 
-i16_t index_of(char const *text, i32_t length, bool &is_global, bool &reference, u8_t &count) {
+i16_t Compiler::index_of(char const *text, i32_t length, bool &is_global, bool &reference, u8_t &count) {
     i32_t index;
     is_global = false;
     reference = false;
@@ -2068,14 +3349,14 @@ i16_t index_of(char const *text, i32_t length, bool &is_global, bool &reference,
     }
 
     if (!globals2.contains({text, length}, index))
-        return -1;
+        return no_index;
     
     is_global = true;
     return index;
 }
 
 
-void function_call() {
+void Compiler::function_call() {
     i32_t address;
     i8_t arguments;
     vector<u8_t> dummy;
@@ -2136,7 +3417,7 @@ void function_call() {
             bool reference = false;
             u8_t count;
             auto index = index_of(text, text_len, is_global, reference, count);
-            if (index == -1) {
+            if (index == no_index) {
                 undefined_reference();
                 return; 
             }
@@ -2200,34 +3481,32 @@ balance_label:
         return;
     }
 
-    emit_jump(ret_addr);
-    auto return_addr = code.size();
-    emit_three_bytes(jump, as_t<i16_t>(address));
-    set_correct_code_address(code.size(), return_addr);
+    i32_t start = code.size();
+    emit_five_bytes(call, address);
+    emit_single_byte(as_t<u8_t>(arguments));
 
-    for (i8_t i = 0; i < arguments; ++i)
-        emit_single_byte(ipop);
-    emit_single_byte(load_ret_value);
+    bool references = std::any_of(refs.begin(), refs.end(), [](u8_t ref) { return ref > 0; });
+    last_call = {start, i32_t(code.size()), address, arguments, references};
 }
 
-void parse_primary_expression() {
+void Compiler::parse_primary_expression() {
     switch (gettoken()) {
         case Integer:
-            emit_value(int_c, to_i64(text, text_len));
+            emit_constant(to_i64(text, text_len));
             break;
         case Character:
             {
                 char c = text[1];
                 if (c == '\\')
                     c = escape_character(text[2]);
-                emit_value(char_c, c);
+                emit_constant(c);
             }
             break;
         case Double:
-            emit_value(double_c, to_double(text, text_len));
+            emit_constant(to_double(text, text_len));
             break;
         case String:
-            emit_value(string_c, Value(text+1, text_len - 2));
+            emit_constant(Value(text+1, text_len - 2));
             break;
         case LeftParen:
             {
@@ -2245,10 +3524,10 @@ void parse_primary_expression() {
                 
                 if (is_cast) {
                     switch (tok) {
-                        case Int_t: emit_single_byte(cast_to_int); break;
-                        case Double_t: emit_single_byte(cast_to_double); break;
-                        case Char_t: emit_single_byte(cast_to_char); break;
-                        case Bool_t: emit_single_byte(cast_to_bool); break;
+                        case Int_t: emit_unary(cast_to_int); break;
+                        case Double_t: emit_unary(cast_to_double); break;
+                        case Char_t: emit_unary(cast_to_char); break;
+                        case Bool_t: emit_unary(cast_to_bool); break;
                         default:
                             break;
                     }
@@ -2263,7 +3542,7 @@ void parse_primary_expression() {
                 bool is_string = false;
                 auto index = index_of(text, text_len, is_global, reference, count, is_string);
           
-                if (index == -1) {
+                if (index == no_index) {
                     undefined_reference();
                     return;
                 }
@@ -2283,6 +3562,14 @@ void parse_primary_expression() {
                     return;
                 }
 
+                if (!is_global && !reference && count <= 1) {
+                    auto &var = locals.variables[locals.find(text, text_len)];
+                    if (var.is_constant) {
+                        emit_constant(var.constant);
+                        break;
+                    }
+                }
+
                 OpCode op = (is_global) ? get_global : get_local;
                 if (reference && !is_global)
                     op = get_local_ref;
@@ -2303,13 +3590,13 @@ void parse_primary_expression() {
             }
             break;
         case Nil:
-            emit_single_byte(nil);
+            emit_constant(nullptr);
             break;
         case True:
-            emit_single_byte(true_l);
+            emit_constant(true);
             break;
         case False:
-            emit_single_byte(false_l);
+            emit_constant(false);
             break;
         case FuncIdentifier:
             function_call();
@@ -2325,7 +3612,7 @@ void parse_primary_expression() {
     }
 }
 
-void unary_expression(i8_t parentPrecedence) {
+void Compiler::unary_expression(i8_t parentPrecedence) {
     gettoken();
     auto op = cur_token;
 
@@ -2343,7 +3630,7 @@ void unary_expression(i8_t parentPrecedence) {
         bool is_string = false;
         auto index = index_of(text, text_len, is_global, reference, count, is_string);
 
-        if (index == -1) {
+        if (index == no_index) {
             undefined_reference();
             return;
         }
@@ -2396,56 +3683,56 @@ void unary_expression(i8_t parentPrecedence) {
             emit_single_byte(pre_dec, op.line);
             break;
         case Plus:
-            emit_single_byte(positive, op.line);
+            emit_unary(positive, op.line);
             break;
         case Minus:
-            emit_single_byte(neg, op.line);
+            emit_unary(neg, op.line);
             break;
         case Bang:
-            emit_single_byte(inot, op.line);
+            emit_unary(inot, op.line);
             break;
         default:
             break;
     }
 }
 
-void binary_expression(i8_t parentPrecedence) {
+void Compiler::binary_expression(i8_t parentPrecedence) {
     gettoken();
     auto op = cur_token;
     parse_expression(parentPrecedence);
     switch (op._kind) {
         case Plus:
-            emit_single_byte(add, op.line);
+            emit_binary(add, op.line);
             break;
         case Minus:
-            emit_single_byte(sub, op.line);
+            emit_binary(sub, op.line);
             break;
         case Star:
-            emit_single_byte(mult, op.line);
+            emit_binary(mult, op.line);
             break;
         case Slash:
-            emit_single_byte(idiv, op.line);
+            emit_binary(idiv, op.line);
             break;
         case Modulus:
-            emit_single_byte(mod, op.line);
+            emit_binary(mod, op.line);
             break;
         case LessThan:
-            emit_single_byte(lt, op.line);
+            emit_binary(lt, op.line);
             break;
         case LessEqual:
-            emit_single_byte(lte, op.line);
+            emit_binary(lte, op.line);
             break;
         case GreaterThan:
-            emit_single_byte(gt, op.line);
+            emit_binary(gt, op.line);
             break;
         case GreaterEqual:
-            emit_single_byte(gte, op.line);
+            emit_binary(gte, op.line);
             break;
         case EqualEqual:
-            emit_single_byte(eq, op.line);
+            emit_binary(eq, op.line);
             break;
         case NotEqual:
-            emit_single_byte(neq, op.line);
+            emit_binary(neq, op.line);
             break;
         case LogicalAnd:
             emit_single_byte(logical_and, op.line);
@@ -2458,7 +3745,7 @@ void binary_expression(i8_t parentPrecedence) {
     }   
 }
 
-void parse_expression(i8_t parentPrecedence) {
+void Compiler::parse_expression(i8_t parentPrecedence) {
     auto tok = peek_token();
     auto precedence = unary_operator_precedence(tok);
     if (precedence == -1) {
@@ -2485,23 +3772,22 @@ void parse_expression(i8_t parentPrecedence) {
             break;
         }
 
-        if (tok == LogicalAnd) {
-            emit_jump(jif);
-            auto prev_index = code.size();
-            binary_expression(precedence);
-            set_correct_code_address(code.size(), prev_index);
-        } else if (tok == LogicalOr) {
-            emit_jump(jit);
+        if (tok == LogicalAnd || tok == LogicalOr) {
+            auto left = trailing_constants(1);
+            auto constant_left = (left >= 0 ? constant_pushes[left] : ConstantPush{});
+            emit_jump(tok == LogicalAnd ? jif : jit);
             auto prev_index = code.size();
             binary_expression(precedence);
             set_correct_code_address(code.size(), prev_index);
+            if (left >= 0)
+                fold_short_circuit(constant_left, prev_index, tok == LogicalOr);
         } else {
             binary_expression(precedence);
         }
     }
 }
 
-void parse_assignment(i8_t parentPrecedence) {
+void Compiler::parse_assignment(i8_t parentPrecedence) {
     auto tok1 = peek_token();
     auto tok2 = peek_token(true, 1);
     if (tok1 == Identifier && tok2 == Equal) {
@@ -2515,7 +3801,7 @@ void parse_assignment(i8_t parentPrecedence) {
         u8_t count;
         bool is_string = false;
         auto index = index_of(identifier, identifier_len, is_global, reference, count, is_string);
-        if (index == -1) {
+        if (index == no_index) {
             undefined_reference(identifier, identifier_len, save_line);
             while ((tok1 = peek_token()) != Semicolon && tok1 != RightParen && tok1 != RightBrace && 
                     tok1 != Comma && tok1 != Eof)
@@ -2534,7 +3820,7 @@ void parse_assignment(i8_t parentPrecedence) {
                 bool reference = false;
                 bool is_string = false;
                 auto index = index_of(text, text_len, is_global, reference, count, is_string);
-                if (index == -1) {
+                if (index == no_index) {
                     undefined_reference();
                     return;
                 }
@@ -2601,7 +3887,7 @@ void parse_assignment(i8_t parentPrecedence) {
         u8_t count;
         bool is_string = false;
         auto index = index_of(identifier, identifier_len, is_global, reference, count, is_string);
-        if (index == -1) {
+        if (index == no_index) {
             undefined_reference(identifier, identifier_len, save_line);
             return;
         }
@@ -2618,7 +3904,7 @@ void parse_assignment(i8_t parentPrecedence) {
     }
 }
 
-void parse_print_arguments() {
+void Compiler::parse_print_arguments() {
     skip_whitespace();
 
     if (peek_c() != '"') {
@@ -2709,7 +3995,7 @@ void parse_print_arguments() {
     }
 }
 
-void parse_print_statement() {
+void Compiler::parse_print_statement() {
     gettoken();
     auto tok = cur_token;
     consume(LeftParen);
@@ -2725,7 +4011,7 @@ void parse_print_statement() {
     print_arguments = 0;
 }
 
-void parse_expression_statement() {
+void Compiler::parse_expression_statement() {
     if (peek_token() == Semicolon) {
         gettoken();
         return;
@@ -2735,12 +4021,12 @@ void parse_expression_statement() {
     emit_single_byte(ipop);
 }
 
-void start_new_scope() {
+void Compiler::start_new_scope() {
     cur_local_index = 0;
     ++cur_scope_depth;
 }
 
-void end_new_scope() {
+void Compiler::end_new_scope() {
     while (locals.variables.size() > 0 && locals.back().scope == cur_scope_depth && cur_local_index > 0) {
         auto count = locals.back().count;
         if (count > 1) {
@@ -2757,26 +4043,79 @@ void end_new_scope() {
     --cur_scope_depth;
 }
 
-void parse_declaration(TokenKind kind);
-
-void parse_block_statement() {
-    ++cur_scope_depth;
-    gettoken(); /* eat '{' */
 
+/* the declarations of a block up to its '}'. nothing after a return runs,
+ * so what follows it is only compiled for its errors and dropped again */
+void Compiler::parse_declarations() {
+    i32_t unreachable = -1;
     auto tok = peek_token();
     while (tok != RightBrace && tok != Eof) {
         parse_declaration(tok);
+        if (tok == Return && unreachable < 0)
+            unreachable = code.size();
         tok = peek_token();
     }
+
+    if (unreachable >= 0) {
+        truncate_code(unreachable);
+        return_found = true;
+    }
+}
+
+void Compiler::parse_block_statement() {
+    ++cur_scope_depth;
+    gettoken(); /* eat '{' */
+
+    parse_declarations();
     consume(RightBrace);
     end_new_scope();
 }
 
-void parse_if_statement() {
+
+/* an if whose condition is a constant: the block it skips and the elif and
+ * else parts it never gets to are compiled for their errors and dropped */
+void Compiler::parse_constant_if(bool taken, i32_t start) {
+    truncate_code(start);
+    if (peek_token() != LeftBrace) {
+        gettoken();
+        unexpected_token("{", cur_token);
+        return;
+    }
+
+    parse_block_statement();
+    if (!taken)
+        truncate_code(start);
+
+    i32_t rest = code.size();
+    if (peek_token() == Elif)
+        parse_if_statement();
+
+    if (peek_token() == Else) {
+        gettoken();
+        if (peek_token() != LeftBrace) {
+            gettoken();
+            unexpected_token("{", cur_token);
+            return;
+        }
+        parse_block_statement();
+    }
+
+    if (taken)
+        truncate_code(rest);
+}
+
+void Compiler::parse_if_statement() {
     gettoken();
     consume(LeftParen);
+    i32_t start = code.size();
     parse_expression();
     consume(RightParen);
+
+    auto condition = trailing_constants(1);
+    if (condition >= 0 && constant_pushes[condition].start == start) {
+        parse_constant_if(constant_pushes[condition].val.as_bool(), start);
+        return;
+    }
     
     emit_jump(jif);
     auto prev_index = code.size();
@@ -2812,13 +4151,32 @@ void parse_if_statement() {
     set_correct_code_address(code.size(), prev_index2);
 }
 
-void parse_while_statement() {
+void Compiler::parse_while_statement() {
     gettoken();
     consume(LeftParen);
     auto loop_start = code.size();
     parse_expression();
     consume(RightParen);
 
+    /* a loop that never runs is dropped, one that never stops loses its test */
+    auto condition = trailing_constants(1);
+    if (condition >= 0 && constant_pushes[condition].start == i32_t(loop_start)) {
+        bool forever = constant_pushes[condition].val.as_bool();
+        truncate_code(loop_start);
+        if (peek_token() != LeftBrace) {
+            gettoken();
+            unexpected_token("{", cur_token);
+            return;
+        }
+
+        parse_block_statement();
+        if (forever)
+            emit_five_bytes(jump, as_t<i32_t>(loop_start));
+        else
+            truncate_code(loop_start);
+        return;
+    }
+
     emit_jump(jif);
     auto exit_loop = code.size();
     emit_single_byte(ipop);
@@ -2830,16 +4188,14 @@ void parse_while_statement() {
     }
     
     parse_block_statement();
-    emit_three_bytes(jump, as_t<u16_t>(loop_start));
+    emit_five_bytes(jump, as_t<i32_t>(loop_start));
     set_correct_code_address(code.size(), exit_loop);
     emit_single_byte(ipop);
 }
 
-void parse_declaration(TokenKind kind);
-void parse_variable_declaration(bool consume_semicolon = true);
 
 /* inefficient for loop, takes more time to execute than while loop */
-void parse_for_statement() {
+void Compiler::parse_for_statement() {
     ++cur_scope_depth;
     gettoken();
     consume(LeftParen);
@@ -2869,7 +4225,7 @@ void parse_for_statement() {
         loop_start = code.size();
         parse_assignment();
         emit_single_byte(ipop);
-        emit_three_bytes(jump, as_t<i16_t>(check_expression));
+        emit_five_bytes(jump, as_t<i32_t>(check_expression));
     }
     consume(RightParen);
 
@@ -2882,7 +4238,7 @@ void parse_for_statement() {
     set_correct_code_address(code.size(), body);
     parse_block_statement();
 
-    emit_three_bytes(jump, as_t<u16_t>(loop_start));
+    emit_five_bytes(jump, as_t<i32_t>(loop_start));
     if (has_expression) {
         set_correct_code_address(code.size(), exit_loop);
         emit_single_byte(ipop);
@@ -2891,7 +4247,7 @@ void parse_for_statement() {
 }
 
 /* more efficient for loop */
-void parse_for_loop_effeciently() {
+void Compiler::parse_for_loop_effeciently() {
     ++cur_scope_depth;
     gettoken();
     consume(LeftParen);
@@ -2915,15 +4271,14 @@ void parse_for_loop_effeciently() {
     }
 
     consume(Semicolon);
-    auto save_source_index = source_index;
     bool has_increment = false;
-    tok = peek_token();
-    if (tok != RightParen) {
+    CapturedCode increment;
+    if (peek_token() != RightParen) {
         has_increment = true;
-        while (tok != RightParen) {
-            gettoken(false);
-            tok = peek_token();
-        }
+        auto increment_start = code.size();
+        parse_assignment();
+        emit_single_byte(ipop);
+        increment = capture_code(increment_start);
     }
 
     consume(RightParen);
@@ -2934,14 +4289,9 @@ void parse_for_loop_effeciently() {
     }
     
     parse_block_statement();
-    if (has_increment) {
-        auto save_source_index2 = source_index;
-        source_index = save_source_index;
-        parse_assignment();
-        emit_single_byte(ipop);
-        source_index = save_source_index2;
-    }
-    emit_three_bytes(jump, as_t<u16_t>(loop_start));
+    if (has_increment)
+        emit_captured(increment);
+    emit_five_bytes(jump, as_t<i32_t>(loop_start));
     if (has_expression) {
         set_correct_code_address(code.size(), exit_loop);
         emit_single_byte(ipop);
@@ -2949,8 +4299,21 @@ void parse_for_loop_effeciently() {
     end_new_scope();
 }
 
-void parse_return_statement() {
+/* return f(...) is a tail call when f takes as many arguments as the
+ * function it is returned from and neither takes references. the new
+ * arguments are put where the current ones are, so f can use the frame the
+ * current function was called with and its ret goes straight to the caller */
+bool Compiler::is_tail_call() {
+    if (last_call.end != i32_t(code.size()) || cur_function < 0)
+        return false;
+    auto &caller = functions.functions.at(cur_function);
+    return caller.address != main_addr && caller.arguments == last_call.arguments && !last_call.references &&
+        std::all_of(caller.argumets_with_ref.begin(), caller.argumets_with_ref.end(), [](u8_t ref) { return ref == 0; });
+}
+
+void Compiler::parse_return_statement() {
     return_found = true;
+    last_call = {};
     gettoken();
     if (peek_token() != Semicolon) {
         parse_assignment();
@@ -2958,7 +4321,19 @@ void parse_return_statement() {
         emit_value(int_c, as_t<i64_t>(0));
     }
     consume(Semicolon);
-    emit_single_byte(store_ret_value);
+
+    if (!is_tail_call()) {
+        bool in_main = cur_function >= 0 && functions.functions.at(cur_function).address == main_addr;
+        emit_single_byte(in_main ? main_ret : ret);
+        return_end = code.size();
+        return;
+    }
+
+    truncate_code(last_call.start);
+    for (i8_t i = last_call.arguments - 1; i >= 0; --i) {
+        emit_three_bytes(set_local, -(last_call.arguments - i));
+        emit_single_byte(ipop);
+    }
     auto &local_vars = locals.variables;
     if (local_vars.size() > 0) {
         if (cur_local_index > 0) {  // if return statement is in somewhere inner blocks
@@ -2989,11 +4364,10 @@ void parse_return_statement() {
             }
         }
     }
-    emit_jump(jump);
-    exit_addrs.push_back(code.size());
+    emit_five_bytes(jump, last_call.address);
 }
 
-void parse_input_statement(OpCode op1, OpCode op2, OpCode op3, OpCode op4 = main_ret) {
+void Compiler::parse_input_statement(OpCode op1, OpCode op2, OpCode op3, OpCode op4) {
     gettoken();
     consume(LeftParen);
     consume(Identifier);
@@ -3015,7 +4389,7 @@ void parse_input_statement(OpCode op1, OpCode op2, OpCode op3, OpCode op4 = main
     bool reference = false;
     u8_t count;
     i16_t index = index_of(ident_name, ident_len, is_global, reference, count);
-    if (index == -1) {
+    if (index == no_index) {
         undefined_reference(ident_name, ident_len, save_line);
         return; 
     }
@@ -3032,19 +4406,19 @@ void parse_input_statement(OpCode op1, OpCode op2, OpCode op3, OpCode op4 = main
     emit_three_bytes(op1, index, save_line);
 }
 
-void parse_get_c() {
+void Compiler::parse_get_c() {
     parse_input_statement(get_c, local_get_c, local_get_c_ref, local_array_get_c);
 }
 
-void parse_get_i() {
+void Compiler::parse_get_i() {
     parse_input_statement(get_i, local_get_i, local_get_i_ref, local_array_get_i);
 }
 
-void parse_get_d() {
+void Compiler::parse_get_d() {
     parse_input_statement(get_d, local_get_d, local_get_d_ref, local_array_get_d);
 }
 
-void parse_get_s() {
+void Compiler::parse_get_s() {
     consume(Get_S);
     consume(LeftParen);
     consume(Identifier);
@@ -3054,7 +4428,7 @@ void parse_get_s() {
     bool is_reference = false;
     bool is_string = false;
     auto index = index_of(text, text_len, is_global, is_reference, count, is_string);
-    if (index == -1) {
+    if (index == no_index) {
         undefined_reference(text, text_len, line);
         return; 
     }
@@ -3073,7 +4447,7 @@ void parse_get_s() {
     emit_array_indexing(local_get_s, index, count);
 }
 
-void parse_statement(TokenKind kind) {
+void Compiler::parse_statement(TokenKind kind) {
     if (kind == Print) {
         parse_print_statement();
     } else if (kind == If) {
@@ -3099,7 +4473,7 @@ void parse_statement(TokenKind kind) {
     }
 }
 
-void define_variable(char const *identifier, i32_t identifier_len, i32_t _line, u8_t count, i32_t index = -1) {
+void Compiler::define_variable(char const *identifier, i32_t identifier_len, i32_t _line, u8_t count, i32_t index) {
     if (cur_scope_depth == 0) {
         StringLiteral name = {identifier, identifier_len};
         if (globals2.contains(name)) {
@@ -3125,7 +4499,117 @@ void define_variable(char const *identifier, i32_t identifier_len, i32_t _line,
     }
 }
 
-void parse_variable_declaration(bool consume_semicolon) {
+/* calls written(name) for every name the print arguments in a string may
+ * write. they are not tokens yet, a name is taken as written when it is
+ * next to '=', '++', '--' or a single '&' */
+template <typename F>
+void writes_in_string(std::string_view str, F written) {
+    for (std::size_t at = 0; at < str.size(); ) {
+        if (!is_identifier_char(str[at])) {
+            ++at;
+            continue;
+        }
+        auto end = at;
+        while (end < str.size() && is_identifier_char(str[end]))
+            ++end;
+        auto name = str.substr(at, end - at);
+
+        auto before = at;
+        while (before > 0 && str[before - 1] == ' ')
+            --before;
+        auto after = end;
+        while (after < str.size() && str[after] == ' ')
+            ++after;
+        at = end;
+
+        if ((after < str.size() && str[after] == '=' && (after + 1 == str.size() || str[after + 1] != '=')) ||
+                (before >= 2 && (str.substr(before - 2, 2) == "++" || str.substr(before - 2, 2) == "--")) ||
+                (before >= 1 && str[before - 1] == '&' && (before < 2 || str[before - 2] != '&')))
+            written(name);
+    }
+}
+
+/* goes over a function body once, token by token without compiling, and
+ * puts every local declared in it that the rest of its block may write
+ * into written_locals. a variable of the same name counts as a write */
+void Compiler::find_written_locals() {
+    auto save_text = text;
+    auto save_source_index = source_index;
+    auto save_text_len = text_len;
+    auto save_line = line;
+    Token save_token = cur_token;
+
+    /* the locals declared in the blocks still open that nothing wrote yet,
+     * by identifier. offsets only grow, so those of the innermost block are
+     * at the back */
+    std::unordered_map<u32_t, vector<i32_t>> pending;
+    vector<std::pair<i32_t, vector<u32_t>>> blocks{{-1, {}}};   /* '{' offset and the ids declared */
+
+    auto write = [&](u32_t id) {
+        auto found = pending.find(id);
+        if (found == pending.end())
+            return;
+        for (auto offset: found->second)
+            written_locals.insert(offset);
+        found->second.clear();
+    };
+
+    written_locals.clear();
+    TokenKind before = Semicolon, prev = Semicolon, tok;
+    u32_t name_before = 0;      /* identifier right before the current token */
+    while (true) {
+        tok = gettoken(false);
+        if (tok == Eof || (tok == RightBrace && blocks.size() == 1))
+            break;
+        if (tok == Error || tok == Unrecognized) {
+            for (auto &names: pending)
+                write(names.first);
+            break;
+        }
+
+        if (name_before && tok == Equal)
+            write(name_before);
+        name_before = 0;
+
+        if (tok == LeftBrace) {
+            blocks.push_back({i32_t(text - source), {}});
+        } else if (tok == RightBrace) {
+            for (auto id: blocks.back().second) {
+                auto &offsets = pending[id];
+                while (!offsets.empty() && offsets.back() > blocks.back().first)
+                    offsets.pop_back();
+            }
+            blocks.pop_back();
+        } else if (tok == String) {
+            writes_in_string(std::string_view(text, text_len), [&](std::string_view name) {
+                write(identifiers.intern(name.data(), i32_t(name.size())));
+            });
+        } else if (tok == Identifier) {
+            auto id = identifiers.intern(text, text_len);
+            if (prev == PrefixInc || prev == PrefixDec || prev == Reference || prev == Var)
+                write(id);
+            else if (prev == LeftParen && (before == Get_C || before == Get_I || before == Get_D || before == Get_S))
+                write(id);
+            else
+                name_before = id;
+
+            if (prev == Var) {
+                pending[id].push_back(i32_t(text - source));
+                blocks.back().second.push_back(id);
+            }
+        }
+        before = prev;
+        prev = tok;
+    }
+
+    source_index = save_source_index;
+    text = save_text;
+    text_len = save_text_len;
+    cur_token = save_token;
+    line = save_line;
+}
+
+void Compiler::parse_variable_declaration(bool consume_semicolon) {
     gettoken(); /* eat var */
     consume(Identifier);
     if (parse_error)
@@ -3135,6 +4619,7 @@ void parse_variable_declaration(bool consume_semicolon) {
     auto save_line = line;
     bool is_array = false;
     u8_t count = 1;
+    i32_t constant = -1;    /* in constant_pushes, what the variable starts with */
 
     auto tok = peek_token();
     auto index = cur_local_index;
@@ -3176,7 +4661,13 @@ void parse_variable_declaration(bool consume_semicolon) {
             }
             consume(RightBrace);
         } else {
+            i32_t start = code.size();
             parse_assignment();
+
+            auto pushed = trailing_constants(1);
+            if (pushed >= 0 && constant_pushes[pushed].start == start && cur_scope_depth > 0 &&
+                    !written_locals.count(i32_t(identifier - source)))
+                constant = pushed;
         }
     } else {
         if (is_array) {
@@ -3189,12 +4680,17 @@ void parse_variable_declaration(bool consume_semicolon) {
     }
     
     cur_local_index = save_cur_index;
+    auto defined = locals.variables.size();
     define_variable(identifier, identifier_len, save_line, count, index);
+    if (constant >= 0 && locals.variables.size() > defined) {
+        locals.back().is_constant = true;
+        locals.back().constant = constant_pushes[constant].val;
+    }
     if (consume_semicolon)
         consume(Semicolon);
 }
 
-void parse_function_body() {
+void Compiler::parse_function_body() {
     consume(LeftBrace); /* eat '{' */
     auto tok = peek_token();
     while (tok != RightBrace && tok != Eof) {
@@ -3209,7 +4705,7 @@ void parse_function_body() {
     consume(RightBrace);
 }
 
-void parse_function_declaration() {
+void Compiler::parse_function_declaration() {
     start_new_scope();
     gettoken(); /* eat 'func' */
     consume(FuncIdentifier);
@@ -3271,7 +4767,7 @@ void parse_function_declaration() {
     if (arguments > 0) {
         for (i8_t i = 0; i < arguments; ++i) {
             auto &local = locals[arguments - 1 - i];
-            local.index = -(2 + arguments - i);
+            local.index = -(arguments - i);
             last_arg_index = local.index;
         }
 
@@ -3295,43 +4791,24 @@ void parse_function_declaration() {
 
     i32_t address = code.size();
     functions.declare(func_name, func_name_len, address, arguments, std::move(refs));
+    cur_function = functions.functions.size() - 1;
     OpCode return_value = ret;
     if (func_name_len == 4 && std::strncmp(func_name, "main", 4) == 0) {
         main_addr = address;
         return_value = main_ret;
     }
-    emit_single_byte(ipush_bp);
+    emit_single_byte(enter);
 
-    while (tok != RightBrace && tok != Eof) {
-        parse_declaration(tok);
-        tok = peek_token();
-    }
+    find_written_locals();
+    parse_declarations();
     consume(RightBrace);
-    if (!exit_addrs.empty()) {
-        for (auto &exit_function: exit_addrs) {
-            set_correct_code_address(code.size(), exit_function);
-        }
-        exit_addrs.clear();
-    }
-    if (!return_found) {
+    /* every function ends with a ret, the ret of its last return or one
+     * returning 0 */
+    if (!return_found || i32_t(code.size()) != return_end) {
         emit_value(int_c, as_t<i64_t>(0));
-        emit_single_byte(store_ret_value);
-        auto &local_vars = locals.variables;
-        if (local_vars.size() > 0) {
-            for (auto i = 1; local_vars.size() >= i; ++i) {
-                auto local = local_vars.at(local_vars.size() - i);
-                if (!(local.scope > 0 && local.index >= 0)) {
-                    break;
-                }
-                if (local.count > 1) {
-                    for (i32_t j = 0; j < local.count; ++j)
-                        emit_single_byte(ipop);
-                } else {
-                    emit_single_byte(ipop);
-                }
-            }
-        }
+        emit_single_byte(return_value);
     }
+    functions.functions.at(cur_function).end = code.size() - 1;
 
     while (locals.variables.size() > 0 && cur_local_index > 0) {
         --cur_local_index;
@@ -3340,12 +4817,9 @@ void parse_function_declaration() {
     cur_scope_depth = 0;
     for (i8_t i = 0; i < arguments; ++i)
         locals.pop();
-
-    emit_single_byte(ipop_bp);
-    emit_single_byte(return_value); 
 }
 
-void define_string(char const *name, i32_t length, i32_t _line, i32_t index, u8_t count) {
+void Compiler::define_string(char const *name, i32_t length, i32_t _line, i32_t index, u8_t count) {
     /* TODO: add support for global strings */
     if (locals.contains(cur_scope_depth, name, length)) {
         redefining_variable(name, length, _line);
@@ -3356,7 +4830,7 @@ void define_string(char const *name, i32_t length, i32_t _line, i32_t index, u8_
     emit_array_indexing(define_local_array, as_t<i16_t>(index), count, _line); 
 }
 
-void parse_string_declaration() {
+void Compiler::parse_string_declaration() {
     consume(String_Type);
     consume(Identifier);
     auto identifier = text;
@@ -3409,7 +4883,7 @@ void parse_string_declaration() {
     consume(Semicolon);
 }
 
-void parse_declaration(TokenKind kind) {
+void Compiler::parse_declaration(TokenKind kind) {
     return_found = false;
     if (kind == Var) {
         parse_variable_declaration();
@@ -3423,7 +4897,7 @@ void parse_declaration(TokenKind kind) {
         synchronize();
 }
 
-void parse_functions(TokenKind kind) {
+void Compiler::parse_functions(TokenKind kind) {
     if (kind == Func) {
         parse_function_declaration();
     } else {
@@ -3436,7 +4910,107 @@ void parse_functions(TokenKind kind) {
 
 /* compiler start */
 
-bool compile() {
+/* functions that main does not call, not even through other functions, are
+ * cut out of code after compiling. everything that points into code moves
+ * along with what is kept */
+void Compiler::remove_unused_functions() {
+    auto &funcs = functions.functions;
+    std::unordered_map<i32_t, i32_t> function_at;  /* address -> index in funcs */
+    vector<i32_t> ends(funcs.size());
+    for (i32_t i = 0; i < i32_t(funcs.size()); ++i) {
+        ends[i] = funcs[i].end + 1;
+        function_at[funcs[i].address] = i;
+    }
+
+    /* a call, or a tail call, which is a jump to the function */
+    vector<bool> used(funcs.size(), false);
+    vector<i32_t> work;
+    auto calls = [&](i32_t start, i32_t end) {
+        for (auto offset = start; offset < end; offset += 1 + operand_bytes(OpCode(code[offset]))) {
+            auto op = OpCode(code[offset]);
+            if (op != call && op != jump)
+                continue;
+            auto callee = function_at.find(get_quad_byte_index(offset + 1));
+            if (callee != function_at.end() && !used[callee->second]) {
+                used[callee->second] = true;
+                work.push_back(callee->second);
+            }
+        }
+    };
+
+    auto entry = function_at.find(main_addr);
+    if (entry == function_at.end())
+        return;
+    used[entry->second] = true;
+    work.push_back(entry->second);
+
+    /* global initializers may call too */
+    vector<std::pair<i32_t, i32_t>> extents;
+    for (i32_t i = 0; i < i32_t(funcs.size()); ++i)
+        extents.push_back({funcs[i].address, ends[i]});
+    std::sort(extents.begin(), extents.end());
+    i32_t outside = 0;
+    for (auto [start, end] : extents) {
+        calls(outside, start);
+        outside = end;
+    }
+    calls(outside, code.size());
+
+    while (!work.empty()) {
+        auto i = work.back();
+        work.pop_back();
+        calls(funcs[i].address, ends[i]);
+    }
+
+    if (std::find(used.begin(), used.end(), false) == used.end())
+        return;
+
+    vector<bool> removed(code.size(), false);
+    for (i32_t i = 0; i < i32_t(funcs.size()); ++i) {
+        if (!used[i])
+            std::fill(removed.begin() + funcs[i].address, removed.begin() + ends[i], true);
+    }
+
+    vector<i32_t> moved(code.size() + 1);
+    vector<u8_t> kept;
+    LineTable kept_lines;
+    for (i32_t offset = 0; offset < i32_t(code.size()); ++offset) {
+        moved[offset] = kept.size();
+        if (removed[offset])
+            continue;
+        kept.push_back(code[offset]);
+        kept_lines.push(lines.at(offset));
+    }
+    moved.back() = kept.size();
+    code = std::move(kept);
+    lines = std::move(kept_lines);
+
+    for (i32_t offset = 0; offset < i32_t(code.size()); offset += 1 + operand_bytes(OpCode(code[offset]))) {
+        if (!is_code_address(OpCode(code[offset])))
+            continue;
+        auto address = moved.at(get_quad_byte_index(offset + 1));
+        for (i32_t i = 0; i < 4; ++i)
+            code[offset + 1 + i] = as_t<u8_t>(address >> (24 - 8 * i));
+    }
+
+    vector<Function> kept_functions;
+    std::fill(functions.by_id.begin(), functions.by_id.end(), -1);
+    for (i32_t i = 0; i < i32_t(funcs.size()); ++i) {
+        if (!used[i])
+            continue;
+        funcs[i].address = moved[funcs[i].address];
+        funcs[i].end = moved[funcs[i].end];
+        id_slot(functions.by_id, identifiers.intern(funcs[i].name, funcs[i].length), -1) = kept_functions.size();
+        kept_functions.push_back(std::move(funcs[i]));
+    }
+    funcs = std::move(kept_functions);
+
+    for (auto &global : global_codes)
+        global = moved[global];
+    main_addr = moved[main_addr];
+}
+
+bool Compiler::compile() {
     auto kind = peek_token();
     while (kind != Eof) {
         if (kind == Var || kind == Func)
@@ -3451,6 +5025,9 @@ bool compile() {
         }
         kind = peek_token();
     }
+
+    if (!compile_error && !parse_error)
+        remove_unused_functions();
     
     if (show_opcodes) {
         disassemble_code("compiler");
@@ -3459,87 +5036,2138 @@ bool compile() {
     return !(compile_error || parse_error);
 }
 
-/* compiler end */
+/* compiler end */
+
+
+/* bytecode cache start */
+
+/* a compiled program is kept next to its source, foo.nc -> foo.ncb, so that
+ * the next run of an unchanged file can skip the lexer, parser and compiler.
+ * the file is only ever read back on the machine that wrote it, so numbers
+ * are stored as they are in memory. strings are stored as bytes and the
+ * names and constants point into the loaded file afterwards */
+bool use_cache = true;
+
+constexpr u32_t cache_version = 5;
+
+struct CacheHeader {
+    char magic[4];
+    u32_t version;
+    u64_t source_hash;
+    u64_t opcode_hash;  /* a cache of an older instruction set is stale */
+    u64_t payload_hash; /* of everything after the header */
+    i32_t main_addr;
+    u32_t code_size;
+    u32_t line_run_count;
+    u32_t value_count;
+    u32_t global_count;
+    u32_t global_code_count;
+    u32_t function_count;
+};
+
+u64_t fnv1a(char const *bytes, std::size_t length, u64_t hash = 0xcbf29ce484222325ull) {
+    for (std::size_t i = 0; i < length; ++i) {
+        hash ^= u8_t(bytes[i]);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+u64_t opcode_hash() {
+    u64_t hash = fnv1a(nullptr, 0);
+    for (auto name : instructions)
+        hash = fnv1a(name, std::strlen(name) + 1, hash);
+    return hash;
+}
+
+std::string cache_path(char const *file) {
+    return std::string(file) + "b";
+}
+
+struct CacheWriter {
+    template <typename T>
+    void put(T val) {
+        auto bytes = reinterpret_cast<char const *>(&val);
+        data.insert(data.end(), bytes, bytes + sizeof(T));
+    }
+
+    void put(StringLiteral str) {
+        put(str.length);
+        data.insert(data.end(), str.text, str.text + str.length);
+    }
+
+    void put(Value val) {
+        auto kind = val.kind();
+        put(u8_t(kind));
+        switch (kind) {
+            case Int_v: put(val.as_int()); break;
+            case Char_v: put(val.as_char()); break;
+            case Bool_v: put(val.as_boolean()); break;
+            case Double_v: put(val.as_double()); put(val.precision()); break;
+            case String_v: put(val.as_string()); break;
+            case Nil_v: break;
+        }
+    }
+
+    vector<char> data;
+};
+
+struct CacheReader {
+    template <typename T>
+    bool get(T &val) {
+        if (end - cur < i64_t(sizeof(T)))
+            return false;
+        std::memcpy(&val, cur, sizeof(T));
+        cur += sizeof(T);
+        return true;
+    }
+
+    bool get(StringLiteral &str) {
+        if (!get(str.length) || str.length < 0 || end - cur < str.length)
+            return false;
+        str.text = cur;
+        cur += str.length;
+        return true;
+    }
+
+    bool get(Value &val) {
+        u8_t kind;
+        if (!get(kind))
+            return false;
+        switch (kind) {
+            case Int_v: { i64_t v; if (!get(v)) return false; val = Value(v); return true; }
+            case Char_v: { char v; if (!get(v)) return false; val = Value(v); return true; }
+            case Bool_v: { bool v; if (!get(v)) return false; val = Value(v); return true; }
+            case Double_v: {
+                Fraction v;
+                if (!get(v.val) || !get(v.precision))
+                    return false;
+                val = Value(v);
+                return true;
+            }
+            case String_v: { StringLiteral v; if (!get(v)) return false; val = Value(v); return true; }
+            case Nil_v: val = nullptr; return true;
+        }
+        return false;
+    }
+
+    char const *cur;
+    char const *end;
+};
+
+void Compiler::save_cache(char const *file) {
+    CacheWriter out;
+    CacheHeader header = {{'N', 'C', 'B', '\0'}, cache_version,
+        fnv1a(source, source_length), opcode_hash(), 0, main_addr,
+        u32_t(code.size()), u32_t(lines.runs.size()), u32_t(values.size()), u32_t(globals2.objects.size()),
+        u32_t(global_codes.size()), u32_t(functions.functions.size())};
+    out.put(header);
+    out.data.insert(out.data.end(), code.begin(), code.end());
+    for (auto run : lines.runs)
+        out.put(run);
+    for (auto &val : values)
+        out.put(val);
+    for (i32_t i = 0; i < i32_t(globals2.objects.size()); ++i) {
+        out.put(globals2.objects[i]);
+        out.put(globals2.vals[i]);
+    }
+    for (auto addr : global_codes)
+        out.put(addr);
+    for (auto &func : functions.functions) {
+        out.put(StringLiteral{func.name, func.length});
+        out.put(func.address);
+        out.put(func.end);
+        out.put(func.arguments);
+        out.put(u32_t(func.argumets_with_ref.size()));
+        out.data.insert(out.data.end(), func.argumets_with_ref.begin(), func.argumets_with_ref.end());
+    }
+    header.payload_hash = fnv1a(out.data.data() + sizeof(header), out.data.size() - sizeof(header));
+    std::memcpy(out.data.data(), &header, sizeof(header));
+
+    /* written aside and renamed, so a run that reads the cache at the same
+     * time never sees half a file. failing to write it is not an error */
+    auto path = cache_path(file);
+    auto temp = path + ".tmp";
+    {
+        std::ofstream cache(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!cache.is_open())
+            return;
+        cache.write(out.data.data(), out.data.size());
+        if (!cache)
+            return;
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0)
+        std::remove(temp.c_str());
+}
+
+bool Compiler::map_cache(std::string const &path) {
+#ifdef __linux
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < i64_t(sizeof(CacheHeader))) {
+        close(fd);
+        return false;
+    }
+    void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return false;
+    cache_data = static_cast<char const *>(mem);
+    cache_size = st.st_size;
+#else
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+    file.seekg(0, std::ios::end);
+    auto fsize = as_t<long long>(file.tellg());
+    file.seekg(0, std::ios::beg);
+    if (fsize < i64_t(sizeof(CacheHeader)))
+        return false;
+    auto buffer = new char[fsize];
+    file.read(buffer, fsize);
+    cache_data = buffer;
+    cache_size = fsize;
+#endif
+    return true;
+}
+
+void Compiler::unmap_cache() {
+    if (!cache_data)
+        return;
+#ifdef __linux
+    munmap(const_cast<char *>(cache_data), cache_size);
+#else
+    delete[] cache_data;
+#endif
+    cache_data = nullptr;
+    cache_size = 0;
+}
+
+/* fills in what compile() would have for an unchanged source file. a
+ * missing, stale or broken cache leaves everything empty and returns false */
+bool Compiler::load_cache(char const *file) {
+    if (!map_cache(cache_path(file)))
+        return false;
+
+    CacheReader in{cache_data, cache_data + cache_size};
+    CacheHeader header;
+    in.get(header);
+    bool ok = std::memcmp(header.magic, "NCB", 4) == 0
+        && header.version == cache_version
+        && header.source_hash == fnv1a(source, source_length)
+        && header.opcode_hash == opcode_hash()
+        && header.payload_hash == fnv1a(in.cur, in.end - in.cur)
+        && in.end - in.cur >= i64_t(header.code_size);
+
+    if (ok) {
+        code.assign(in.cur, in.cur + header.code_size);
+        in.cur += header.code_size;
+        lines.runs.resize(header.line_run_count);
+        lines.length = header.code_size;
+        for (u32_t i = 0; ok && i < header.line_run_count; ++i)
+            ok = in.get(lines.runs[i]);
+        ok = ok && (header.code_size == 0 || (header.line_run_count > 0 && lines.runs[0].offset == 0));
+        values.resize(header.value_count);
+        for (u32_t i = 0; ok && i < header.value_count; ++i)
+            ok = in.get(values[i]);
+        for (u32_t i = 0; ok && i < header.global_count; ++i) {
+            StringLiteral name;
+            Value val;
+            ok = in.get(name) && in.get(val);
+            if (ok)
+                globals2.push(name, val);
+        }
+        global_codes.resize(header.global_code_count);
+        for (u32_t i = 0; ok && i < header.global_code_count; ++i)
+            ok = in.get(global_codes[i]);
+        for (u32_t i = 0; ok && i < header.function_count; ++i) {
+            StringLiteral name;
+            i32_t address;
+            i32_t end;
+            i8_t arguments;
+            u32_t ref_count;
+            ok = in.get(name) && in.get(address) && in.get(end) && in.get(arguments)
+                && in.get(ref_count) && in.end - in.cur >= i64_t(ref_count);
+            if (ok) {
+                functions.functions.push_back({name.text, name.length, address, arguments,
+                        vector<u8_t>(in.cur, in.cur + ref_count), end});
+                in.cur += ref_count;
+            }
+        }
+        ok = ok && in.cur == in.end;
+    }
+
+    if (ok) {
+        main_addr = header.main_addr;
+        if (valid_cache_code())
+            return true;
+        main_addr = -1;
+    }
+
+    code.clear();
+    lines.clear();
+    values.clear();
+    globals2.objects.clear();
+    globals2.vals.clear();
+    global_codes.clear();
+    functions.functions.clear();
+    unmap_cache();
+    return false;
+}
+
+u8_t operand_bytes(OpCode op);
+
+/* a cache with the right hashes can still come from a build that wrote it
+ * wrong. everything the decoder and the vm index with an operand is checked
+ * here, so such a cache is compiled again instead of crashing the vm:
+ * opcodes are ones the compiler emits, constants, globals and locals are in
+ * their tables, and jumps, calls and functions start at an instruction */
+bool Compiler::valid_cache_code() {
+    auto size = as_t<i32_t>(code.size());
+    vector<bool> starts(size + 1, false);
+    starts.back() = true;
+    i32_t offset = 0;
+    while (offset < size) {
+        auto op = as_t<OpCode>(code[offset]);
+        if (op > cast_to_bool && op != ret && op != main_ret)
+            return false;
+        starts[offset] = true;
+        offset += 1 + operand_bytes(op);
+    }
+    if (offset != size)
+        return false;
+
+    /* the function every offset belongs to, and the slots above bp its
+     * locals take. arguments are below bp */
+    vector<i32_t> owner(size, -1);
+    vector<i32_t> slots(functions.functions.size(), 0);
+    bool has_main = false;
+    for (i32_t f = 0; f < as_t<i32_t>(functions.functions.size()); ++f) {
+        auto &func = functions.functions[f];
+        if (func.address < 0 || func.end <= func.address || func.end >= size
+                || !starts[func.address] || !starts[func.end]
+                || code[func.address] != enter
+                || (code[func.end] != ret && code[func.end] != main_ret)
+                || func.arguments < 0 || as_t<i32_t>(func.argumets_with_ref.size()) != func.arguments)
+            return false;
+        for (auto i = func.address; i <= func.end; ++i) {
+            if (owner[i] != -1)
+                return false;
+            owner[i] = f;
+        }
+        has_main = has_main || func.address == main_addr;
+    }
+    if (!has_main)
+        return false;
+
+    for (auto addr : global_codes) {
+        if (addr < 0 || addr >= size || !starts[addr] || owner[addr] != -1)
+            return false;
+    }
+
+    auto operand = [&](i32_t offset) {
+        return operand_bytes(as_t<OpCode>(code[offset])) >= 4
+            ? get_quad_byte_index(offset + 1) : get_double_byte_index(offset + 1);
+    };
+
+    for (offset = 0; offset < size; offset += 1 + operand_bytes(as_t<OpCode>(code[offset]))) {
+        auto op = as_t<OpCode>(code[offset]);
+        if (owner[offset] < 0)
+            continue;
+        auto &top = slots[owner[offset]];
+        if (op == define_local)
+            top = std::max(top, operand(offset) + 1);
+        else if (op == define_local_array)
+            top = std::max(top, operand(offset) + code[offset + 3]);
+    }
+
+    for (offset = 0; offset < size; offset += 1 + operand_bytes(as_t<OpCode>(code[offset]))) {
+        auto op = as_t<OpCode>(code[offset]);
+        auto f = owner[offset];
+        i32_t lowest = f < 0 ? 0 : -functions.functions[f].arguments;
+        i32_t highest = f < 0 ? 0 : slots[f];
+        bool ok = true;
+        switch (op) {
+            case int_c:
+            case char_c:
+            case double_c:
+            case string_c: {
+                auto index = operand(offset);
+                ok = index >= 0 && index < as_t<i32_t>(values.size());
+                ok = ok && (op != int_c || values[index].is_int())
+                    && (op != char_c || values[index].is_char())
+                    && (op != double_c || values[index].is_double())
+                    && (op != string_c || values[index].is_string());
+                break;
+            }
+            case jit:
+            case jif:
+            case jump: {
+                auto target = operand(offset);
+                ok = target >= 0 && target <= size && starts[target];
+                break;
+            }
+            case call: {
+                auto target = operand(offset);
+                ok = target >= 0 && target < size && owner[target] >= 0
+                    && functions.functions[owner[target]].address == target
+                    && functions.functions[owner[target]].arguments == code[offset + 5];
+                break;
+            }
+            case enter:
+                ok = f >= 0 && functions.functions[f].address == offset;
+                break;
+            case pre_inc:
+            case pre_dec:
+            case get_c:
+            case get_i:
+            case get_str:
+            case get_d:
+            case define_global:
+            case set_global:
+            case get_global:
+            case load_global_ref:
+            case get_global_ref:
+            case set_global_ref: {
+                auto index = operand(offset);
+                ok = index >= 0 && index < as_t<i32_t>(globals2.objects.size());
+                break;
+            }
+            case pre_inc_local:
+            case pre_dec_local:
+            case local_get_c:
+            case local_get_i:
+            case local_get_d:
+            case local_get_c_ref:
+            case local_get_i_ref:
+            case local_get_s_ref:
+            case local_get_d_ref:
+            case define_local:
+            case set_local:
+            case get_local:
+            case load_local_ref:
+            case get_local_ref:
+            case set_local_ref:
+            case load_array_ref:
+            case get_array_ref:
+            case set_array_ref:
+            case load_arg_array_ref:
+            case get_arg_array_ref:
+            case set_arg_array_ref: {
+                auto index = operand(offset);
+                ok = f >= 0 && index >= lowest && index < highest;
+                break;
+            }
+            case pre_inc_local_array:
+            case pre_dec_local_array:
+            case local_get_s:
+            case define_local_array:
+            case get_local_array:
+            case set_local_array:
+            case local_array_get_c:
+            case local_array_get_i:
+            case local_array_get_d:
+            case set_string:
+            case set_string_index:
+            case get_string: {
+                /* an array of count values that starts at the operand, or
+                 * an argument the compiler treats as one */
+                auto index = operand(offset);
+                ok = f >= 0 && index >= lowest && (index < 0 || index + code[offset + 3] <= highest);
+                break;
+            }
+            default:
+                break;
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+/* bytecode cache end */
+
+
+/* decoder start */
+
+/* number of operand bytes that follow each opcode in code */
+u8_t operand_bytes(OpCode op) {
+    switch (op) {
+        case print:
+            return 1;
+        case pre_inc_local_array:
+        case pre_dec_local_array:
+        case local_get_s:
+        case define_local_array:
+        case get_local_array:
+        case set_local_array:
+        case local_array_get_c:
+        case local_array_get_i:
+        case local_array_get_d:
+        case set_string:
+        case set_string_index:
+        case get_string:
+        case get_array_ref:
+        case set_array_ref:
+            return 3;
+        case int_c:
+        case char_c:
+        case double_c:
+        case string_c:
+        case int_i:
+        case jit:
+        case jif:
+        case jump:
+            return 4;
+        case call:
+            return 5;
+        case pre_inc:
+        case pre_dec:
+        case pre_inc_local:
+        case pre_dec_local:
+        case local_get_c:
+        case local_get_i:
+        case local_get_d:
+        case get_c:
+        case get_i:
+        case get_str:
+        case get_d:
+        case local_get_c_ref:
+        case local_get_i_ref:
+        case local_get_s_ref:
+        case local_get_d_ref:
+        case define_global:
+        case define_local:
+        case set_global:
+        case get_global:
+        case set_local:
+        case get_local:
+        case load_local_ref:
+        case get_local_ref:
+        case set_local_ref:
+        case load_global_ref:
+        case get_global_ref:
+        case set_global_ref:
+        case load_array_ref:
+        case load_arg_array_ref:
+        case get_arg_array_ref:
+        case set_arg_array_ref:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+bool is_code_address(OpCode op) {
+    return op == jit || op == jif || op == jump || op == call;
+}
+
+/* index of the instruction that starts at the given offset of code */
+i32_t VM::program_index(i32_t offset) {
+    return program_indexes.at(offset);
+}
+
+/* keeps program_indexes pointing at the same instructions after program
+ * was rewritten, moved gives the new index of every old one */
+void VM::move_program_indexes(vector<i32_t> const &moved) {
+    for (auto &index : program_indexes) {
+        if (index >= 0)
+            index = moved.at(index);
+    }
+}
+
+/* change of stack depth caused by inst, false for instructions whose
+ * effect is not known here */
+bool stack_effect(Instruction const &inst, i32_t &effect) {
+    switch (inst.op) {
+        case int_c:
+        case char_c:
+        case double_c:
+        case string_c:
+        case int_i:
+        case nil:
+        case true_l:
+        case false_l:
+        case pre_inc:
+        case pre_dec:
+        case pre_inc_local:
+        case pre_dec_local:
+        case get_global:
+        case get_local:
+        case load_local_ref:
+        case get_local_ref:
+        case get_string:
+        case load_array_ref:
+        case load_arg_array_ref:
+            effect = 1;
+            return true;
+        case add:
+        case sub:
+        case mult:
+        case idiv:
+        case mod:
+        case lt:
+        case lte:
+        case gt:
+        case gte:
+        case eq:
+        case neq:
+        case logical_and:
+        case logical_or:
+        case ipop:
+        case define_global:
+        case set_local_array:
+        case local_array_get_c:
+        case local_array_get_i:
+        case local_array_get_d:
+        case set_string_index:
+        case set_array_ref:
+        case ret:
+            effect = -1;
+            return true;
+        case positive:
+        case neg:
+        case inot:
+        case pre_inc_local_array:
+        case pre_dec_local_array:
+        case jit:
+        case jif:
+        case jump:
+        case enter:
+        case local_get_c:
+        case local_get_i:
+        case local_get_s:
+        case local_get_d:
+        case get_c:
+        case get_i:
+        case get_d:
+        case local_get_c_ref:
+        case local_get_i_ref:
+        case local_get_d_ref:
+        case define_local:
+        case define_local_array:
+        case set_global:
+        case set_local:
+        case set_local_ref:
+        case get_local_array:
+        case set_string:
+        case get_array_ref:
+        case cast_to_int:
+        case cast_to_double:
+        case cast_to_char:
+        case cast_to_bool:
+        case main_ret:
+            effect = 0;
+            return true;
+        case print:
+            effect = -inst.count;
+            return true;
+        case call:
+            /* the arguments are replaced by the value returned */
+            effect = 1 - inst.count;
+            return true;
+        default:
+            return false;
+    }
+}
+
+constexpr i32_t unknown_depth = INT32_MIN;
+
+/* stack depth (sp - bp) before every instruction of the function in
+ * [entry, end]. false when an instruction is unknown, or when two paths
+ * reach an instruction with different depths */
+bool VM::frame_depths(i32_t entry, i32_t end, vector<i32_t> &depth) {
+    vector<i32_t> work{entry};
+    depth.at(entry) = 0;
+
+    auto reach = [&](i32_t index, i32_t d) {
+        if (index < entry || index > end)
+            return false;
+        if (depth.at(index) == unknown_depth) {
+            depth.at(index) = d;
+            work.push_back(index);
+        }
+        return depth.at(index) == d;
+    };
+
+    while (!work.empty()) {
+        auto i = work.back();
+        work.pop_back();
+        auto &inst = program.at(i);
+        auto d = depth.at(i);
+        i32_t effect;
+        if (!stack_effect(inst, effect))
+            return false;
+
+        bool ok = true;
+        switch (inst.op) {
+            case enter:
+                ok = i == entry && reach(i + 1, 0);
+                break;
+            case jump:
+                /* a tail call has left the frame */
+                if (program.at(inst.operand).op == enter)
+                    break;
+                ok = reach(inst.operand, d);
+                break;
+            case jit:
+            case jif:
+                ok = reach(inst.operand, d) && reach(i + 1, d);
+                break;
+            case ret:
+            case main_ret:
+                break;
+            default:
+                ok = reach(i + 1, d + effect);
+                break;
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+/* values a call to the function at entry can put on the stack, the
+ * deepest its frame gets. no instruction pushes more than one value, so the
+ * length of the function will do when the depths are not known */
+i32_t VM::frame_size(i32_t entry, i32_t end, vector<i32_t> &depth) {
+    if (!frame_depths(entry, end, depth))
+        return end - entry + 1;
+
+    i32_t deepest = 0;
+    for (i32_t i = entry; i <= end; ++i) {
+        if (depth.at(i) != unknown_depth)
+            deepest = std::max(deepest, depth.at(i));
+    }
+    return deepest;
+}
+
+/* index of the ret or main_ret the function ends with. returns in the
+ * middle of a function are rets as well */
+i32_t VM::function_end(Function const &function) {
+    return program_index(function.end);
+}
+
+/* enter makes sure its frame fits on the stack, see grow_stack() */
+void VM::size_frames() {
+    vector<i32_t> depth(program.size(), unknown_depth);
+    for (auto &function: functions.functions) {
+        i32_t entry = program_index(function.address);
+        program.at(entry).operand = frame_size(entry, function_end(function), depth);
+    }
+}
+
+/* lowers code into program. jump targets and return addresses are turned
+ * into instruction indexes, so they have to be resolved after every
+ * instruction has got its place */
+void VM::decode() {
+    auto &indexes = program_indexes;
+    indexes.assign(code.size() + 1, -1);
+    program.clear();
+
+    for (i32_t offset = 0; offset < as_t<i32_t>(code.size()); ) {
+        auto op = as_t<OpCode>(code.at(offset));
+        auto bytes = operand_bytes(op);
+        Instruction inst{op, 0, 0, offset};
+        if (bytes == 1) {
+            inst.count = code.at(offset + 1);
+        } else if (bytes >= 4) {
+            inst.operand = compiler.get_quad_byte_index(offset + 1);
+            if (bytes == 5)
+                inst.count = code.at(offset + 5);
+        } else if (bytes >= 2) {
+            inst.operand = compiler.get_double_byte_index(offset + 1);
+            if (bytes == 3)
+                inst.count = code.at(offset + 3);
+        }
+
+        indexes.at(offset) = as_t<i32_t>(program.size());
+        program.push_back(inst);
+        offset += 1 + bytes;
+    }
+
+    /* anything that jumps past the last instruction lands here */
+    indexes.back() = as_t<i32_t>(program.size());
+    program.push_back({main_ret, 0, 0, as_t<i32_t>(code.size())});
+
+    for (auto &inst: program) {
+        if (is_code_address(inst.op))
+            inst.operand = indexes.at(inst.operand);
+    }
+
+    size_frames();
+}
+
+i32_t inline_threshold = 16;    /* --inline-threshold, 0 turns inlining off */
+
+/* whether the function at entry can be copied into its callers: it calls
+ * nothing, takes no references and every local it uses can be moved to the
+ * caller's frame. its body is what follows enter, up to its last ret */
+bool VM::inlinable(i32_t entry, i32_t end) {
+    if (program.at(end).op != ret || end - 1 - entry > inline_threshold)
+        return false;
+
+    for (auto i = entry + 1; i < end; ++i) {
+        auto &inst = program.at(i);
+        switch (inst.op) {
+            case jit:
+            case jif:
+            case jump:
+                if (inst.operand <= entry || inst.operand > end)
+                    return false;
+                break;
+            case int_c: case char_c: case double_c: case string_c: case int_i:
+            case nil: case true_l: case false_l:
+            case add: case sub: case mult: case idiv: case mod:
+            case lt: case lte: case gt: case gte: case eq: case neq:
+            case logical_and: case logical_or: case positive: case neg: case inot:
+            case cast_to_int: case cast_to_double: case cast_to_char: case cast_to_bool:
+            case get_local: case set_local: case define_local:
+            case pre_inc_local: case pre_dec_local:
+            case get_global: case set_global: case pre_inc: case pre_dec:
+            case ipop: case print: case ret:
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+/* a call to a small function is replaced by the body of the function. the
+ * arguments the caller pushed become the function's arguments where they
+ * are and its locals go on top of them. a ret becomes a set_local of the
+ * value to where the first argument was, the ipops down to it and a jump
+ * to after the body */
+void VM::inline_calls() {
+    struct Range {
+        i32_t entry;
+        i32_t end;
+    };
+    vector<Range> ranges;
+    vector<i32_t> depth(program.size(), unknown_depth);
+    vector<bool> callable(program.size(), false);
+    for (auto &function: functions.functions) {
+        i32_t entry = program_index(function.address);
+        i32_t end = function_end(function);
+        if (!frame_depths(entry, end, depth))
+            std::fill(depth.begin() + entry, depth.begin() + end + 1, unknown_depth);
+        ranges.push_back({entry, end});
+        bool small = inlinable(entry, end);
+        for (auto ref : function.argumets_with_ref)
+            small = small && ref == 0;
+        /* every ret needs its depth, to know how many values to drop */
+        for (auto i = entry + 1; i <= end && small; ++i)
+            small = program.at(i).op != ret || depth.at(i) != unknown_depth;
+        callable.at(entry) = small;
+    }
+
+    vector<i32_t> callee_end(program.size(), -1);
+    for (auto &range : ranges)
+        callee_end.at(range.entry) = range.end;
+
+    vector<Instruction> out;
+    vector<i32_t> moved(program.size(), -1);
+    vector<bool> copied;    /* out[i] came from a callee, its address is already moved */
+    vector<i32_t> position; /* where each instruction of the body goes, from start */
+    bool changed = false;
+    for (i32_t i = 0; i < as_t<i32_t>(program.size()); ++i) {
+        auto &inst = program.at(i);
+        moved.at(i) = as_t<i32_t>(out.size());
+        auto d = depth.at(i);
+        if (inst.op != call || d == unknown_depth || !callable.at(inst.operand)) {
+            out.push_back(inst);
+            copied.push_back(false);
+            continue;
+        }
+
+        auto entry = inst.operand;
+        auto end = callee_end.at(entry);
+        auto result = d - inst.count;   /* where the first argument is */
+        /* the value a ret returns is at d + depth - 1 */
+        auto drops = [&](i32_t j) { return depth.at(j) - 1 + inst.count; };
+        position.clear();
+        i32_t size = 0;
+        for (auto j = entry + 1; j <= end; ++j) {
+            position.push_back(size);
+            if (program.at(j).op != ret)
+                ++size;
+            else
+                size += (drops(j) > 0) + drops(j) + (j != end);
+        }
+
+        auto start = as_t<i32_t>(out.size());
+        auto after = start + size;
+        for (auto j = entry + 1; j <= end; ++j) {
+            auto body = program.at(j);
+            switch (body.op) {
+                case get_local:
+                case set_local:
+                case define_local:
+                case pre_inc_local:
+                case pre_dec_local:
+                    body.operand = d + body.operand;
+                    break;
+                case jit:
+                case jif:
+                case jump:
+                    body.operand = start + position.at(body.operand - (entry + 1));
+                    break;
+                case ret:
+                    if (drops(j) > 0)
+                        out.push_back({set_local, 0, result, body.offset});
+                    for (i32_t k = 0; k < drops(j); ++k)
+                        out.push_back({ipop, 0, 0, body.offset});
+                    if (j != end)
+                        out.push_back({jump, 0, after, body.offset});
+                    copied.resize(out.size(), true);
+                    continue;
+                default:
+                    break;
+            }
+            out.push_back(body);
+            copied.push_back(true);
+        }
+        changed = true;
+    }
+
+    if (!changed)
+        return;
+
+    for (i32_t i = 0; i < as_t<i32_t>(out.size()); ++i) {
+        if (is_code_address(out.at(i).op) && !copied.at(i))
+            out.at(i).operand = moved.at(out.at(i).operand);
+    }
+    program = std::move(out);
+    move_program_indexes(moved);
+    size_frames();
+}
+
+/* the register translation and the jit read every constant out of values,
+ * they get the immediates put into the pool first */
+void VM::pool_immediates() {
+    for (auto &inst : program) {
+        if (inst.op == int_i) {
+            inst.op = int_c;
+            inst.operand = compiler.intern_constant(as_t<i64_t>(inst.operand));
+        }
+    }
+}
+
+/* decoder end */
+
+
+/* register translation start */
+
+/* with NCC_REGISTER_VM on, the stack code of every function is rewritten
+ * into three address code. register n is the stack slot at bp + n, so
+ * arguments and locals are registers already and a temporary gets the slot
+ * it would have had on the stack. operands are read straight from locals
+ * and the constant table, and only the instructions without a register
+ * form (calls, print, arrays, strings ...) still see the stack, with sp set
+ * right before them */
+
+struct RegisterTranslator {
+    RegisterTranslator(vector<Instruction> &program, vector<Value> &values)
+        : program(program), values(values) { }
+
+    vector<Instruction> &program;   /* of the vm */
+    vector<Value> &values;
+
+    /* what a stack slot holds: register n holds itself once it has been
+     * written, before that it is a copy of a local or a constant */
+    struct Slot {
+        bool constant;
+        i32_t source;
+    };
+
+    vector<Instruction> out;
+    vector<Slot> slots;     /* slot n is register n of the current frame */
+    bool sp_valid = false;  /* whether sp == bp + slots.size() */
+    i32_t literals[3] = {-1, -1, -1};   /* constant index of nil, true and false */
+
+    bool written(i32_t reg) {
+        return !slots.at(reg).constant && slots.at(reg).source == reg;
+    }
+
+    Instruction instruction(OpCode op, i32_t operand, i32_t offset) {
+        return {op, 0, operand, offset};
+    }
+
+    /* src is 1 or 2 */
+    void source(Instruction &inst, u8_t src, Slot slot) {
+        if (slot.constant)
+            inst.count |= src;
+        (src == 1 ? inst.src1 : inst.src2) = as_t<i16_t>(slot.source);
+    }
+
+    void write(i32_t reg, i32_t offset) {
+        if (reg < 0 || reg >= as_t<i32_t>(slots.size()) || written(reg))
+            return;
+        auto inst = instruction(move_r, reg, offset);
+        source(inst, 1, slots.at(reg));
+        out.push_back(inst);
+        slots.at(reg) = {false, reg};
+    }
+
+    void write_all(i32_t offset, i32_t count) {
+        for (i32_t reg = 0; reg < count; ++reg)
+            write(reg, offset);
+    }
+
+    /* the slots still copying reg have to get their value before reg
+     * changes */
+    void before_change(i32_t reg, i32_t offset) {
+        for (i32_t i = 0; i < as_t<i32_t>(slots.size()); ++i) {
+            if (i != reg && !slots.at(i).constant && slots.at(i).source == reg)
+                write(i, offset);
+        }
+    }
+
+    bool copied(i32_t reg) {
+        for (i32_t i = 0; i < as_t<i32_t>(slots.size()); ++i) {
+            if (i != reg && !slots.at(i).constant && slots.at(i).source == reg)
+                return true;
+        }
+        return false;
+    }
+
+    i32_t literal(OpCode op) {
+        auto &index = literals[op - nil];
+        if (index == -1) {
+            index = as_t<i32_t>(values.size());
+            if (op == nil)
+                values.push_back(Value{nullptr});
+            else
+                values.push_back(Value{op == true_l});
+        }
+        return index;
+    }
+
+    /* an instruction that has no register form, it gets the stack as the
+     * stack vm would have left it */
+    void stack_instruction(Instruction const &inst) {
+        write_all(inst.offset, as_t<i32_t>(slots.size()));
+        if (!sp_valid)
+            out.push_back(instruction(set_sp, as_t<i32_t>(slots.size()), inst.offset));
+        out.push_back(inst);
+        sp_valid = true;
+
+        i32_t effect;
+        stack_effect(inst, effect);
+        if (inst.op == enter || inst.op == ret || inst.op == main_ret) {
+            slots.clear();
+            return;
+        }
+        auto depth = as_t<i32_t>(slots.size()) + effect;
+        slots.resize(depth);
+        for (i32_t reg = 0; reg < depth; ++reg)
+            slots.at(reg) = {false, reg};
+    }
+
+    void binary(Instruction const &inst, OpCode op) {
+        auto dest = as_t<i32_t>(slots.size()) - 2;
+        before_change(dest, inst.offset);
+        auto result = instruction(op, dest, inst.offset);
+        source(result, 1, slots.at(dest));
+        source(result, 2, slots.at(dest + 1));
+        out.push_back(result);
+        slots.pop_back();
+        slots.back() = {false, dest};
+        sp_valid = false;
+    }
+
+    /* translates program[i], or more when they are merged into one
+     * instruction, leaving i at the last one. returns false when that
+     * instruction does not continue to the next one */
+    bool translate(i32_t &i, vector<bool> const &block_start) {
+        auto &inst = program.at(i);
+        auto depth = as_t<i32_t>(slots.size());
+        switch (inst.op) {
+            case int_c:
+            case char_c:
+            case double_c:
+            case string_c:
+                if (inst.operand > INT16_MAX) {
+                    stack_instruction(inst);
+                    break;
+                }
+                slots.push_back({true, inst.operand});
+                sp_valid = false;
+                break;
+            case nil:
+            case true_l:
+            case false_l:
+                if (literal(inst.op) > INT16_MAX) {
+                    stack_instruction(inst);
+                    break;
+                }
+                slots.push_back({true, literal(inst.op)});
+                sp_valid = false;
+                break;
+            case get_local:
+                write(inst.operand, inst.offset);
+                slots.push_back({false, inst.operand});
+                sp_valid = false;
+                break;
+            case set_local:
+                {
+                    auto dest = inst.operand;
+                    auto value = slots.back();
+                    if (!value.constant && value.source == dest)
+                        break;
+
+                    /* `x = a + b;` writes the sum into x directly */
+                    if (!block_start.at(i) && !block_start.at(i + 1) && program.at(i + 1).op == ipop
+                            && written(depth - 1) && !out.empty() && out.back().operand == depth - 1
+                            && out.back().op >= add_r && out.back().op <= neq_r
+                            && !copied(dest)) {
+                        out.back().operand = dest;
+                        slots.back() = {false, dest};
+                        if (dest >= 0 && dest < depth)
+                            slots.at(dest) = {false, dest};
+                        break;
+                    }
+
+                    before_change(dest, inst.offset);
+                    auto move = instruction(move_r, dest, inst.offset);
+                    source(move, 1, value);
+                    out.push_back(move);
+                    if (dest >= 0 && dest < depth)
+                        slots.at(dest) = {false, dest};
+                }
+                break;
+            case ipop:
+                slots.pop_back();
+                sp_valid = false;
+                break;
+            case define_local:
+                write(inst.operand, inst.offset);
+                break;
+            case define_local_array:
+                for (i32_t reg = inst.operand; reg < inst.operand + inst.count; ++reg)
+                    write(reg, inst.offset);
+                break;
+            case add:
+                binary(inst, add_r);
+                break;
+            case sub:
+                binary(inst, sub_r);
+                break;
+            case mult:
+                binary(inst, mult_r);
+                break;
+            case idiv:
+                binary(inst, idiv_r);
+                break;
+            case mod:
+                binary(inst, mod_r);
+                break;
+            case lt:
+                binary(inst, lt_r);
+                break;
+            case lte:
+                binary(inst, lte_r);
+                break;
+            case gt:
+                binary(inst, gt_r);
+                break;
+            case gte:
+                binary(inst, gte_r);
+                break;
+            case eq:
+                binary(inst, eq_r);
+                break;
+            case neq:
+                binary(inst, neq_r);
+                break;
+            case jit:
+            case jif:
+                {
+                    /* if, while and for pop the condition on both ways
+                     * out, so it never has to be written anywhere */
+                    bool dropped = program.at(inst.operand).op == ipop && program.at(i + 1).op == ipop;
+                    write_all(inst.offset, dropped ? depth - 1 : depth);
+                    auto branch = instruction(inst.op == jit ? jit_r : jif_r, inst.operand, inst.offset);
+                    source(branch, 1, slots.back());
+                    out.push_back(branch);
+                }
+                break;
+            case jump:
+                write_all(inst.offset, depth);
+                /* a tail call, enter takes sp for the callee's bp */
+                if (program.at(inst.operand).op == enter && !sp_valid)
+                    out.push_back(instruction(set_sp, depth, inst.offset));
+                out.push_back(inst);
+                return false;
+            case pre_inc_local:
+            case pre_dec_local:
+                write(inst.operand, inst.offset);
+                before_change(inst.operand, inst.offset);
+                out.push_back(instruction(inst.op == pre_inc_local ? inc_r : dec_r, inst.operand, inst.offset));
+                slots.push_back({false, inst.operand});
+                sp_valid = false;
+                break;
+            case call:
+                {
+                    /* the value returned is left where the first argument was */
+                    write_all(inst.offset, depth);
+                    auto calling = instruction(call_r, inst.operand, inst.offset);
+                    calling.count = inst.count;
+                    calling.src1 = as_t<i16_t>(depth);
+                    out.push_back(calling);
+                    depth -= inst.count;
+                    slots.resize(depth + 1);
+                    for (i32_t reg = 0; reg <= depth; ++reg)
+                        slots.at(reg) = {false, reg};
+                    sp_valid = true;
+                }
+                break;
+            case ret:
+                {
+                    auto back = instruction(ret_r, 0, inst.offset);
+                    source(back, 1, slots.back());
+                    out.push_back(back);
+                }
+                return false;
+            default:
+                stack_instruction(inst);
+                return inst.op != main_ret;
+        }
+        return true;
+    }
+};
+
+/* -d output for the register forms, constants are shown as k<index> */
+void VM::disassemble_register(Instruction const &inst) {
+    std::fprintf(stderr, "%04d\t%4d\t%20s\t%4d", inst.offset, lines.at(inst.offset), instructions[inst.op], inst.operand);
+    if (inst.op == call_r)
+        std::fprintf(stderr, "\t%4d", inst.src1);
+    else if (inst.op != inc_r && inst.op != dec_r && inst.op != set_sp)
+        std::fprintf(stderr, "\t%s%d", inst.count & 1 ? "k" : "r", inst.src1);
+    if (inst.op >= add_r && inst.op <= neq_r)
+        std::fprintf(stderr, "\t%s%d", inst.count & 2 ? "k" : "r", inst.src2);
+    std::fprintf(stderr, "\n");
+}
+
+/* rewrites every function whose stack depth is known everywhere into
+ * register form. the rest of the program stays as it is */
+void VM::registerize() {
+    pool_immediates();
+    vector<i32_t> depth(program.size(), unknown_depth);
+    vector<bool> translated(program.size(), false);
+    vector<bool> block_start(program.size() + 1, false);
+
+    for (auto &function: functions.functions) {
+        i32_t entry = program_index(function.address);
+        i32_t end = function_end(function);
+        if (!frame_depths(entry, end, depth)) {
+            std::fill(depth.begin() + entry, depth.begin() + end + 1, unknown_depth);
+            continue;
+        }
+        std::fill(translated.begin() + entry, translated.begin() + end + 1, true);
+    }
+
+    for (auto &inst: program) {
+        if (is_code_address(inst.op))
+            block_start.at(inst.operand) = true;
+    }
+
+    RegisterTranslator translator{program, values};
+    vector<i32_t> moved(program.size(), -1);
+    bool live = false;
+    for (i32_t i = 0; i < as_t<i32_t>(program.size()); ++i) {
+        auto &inst = program.at(i);
+        if (!translated.at(i) || depth.at(i) == unknown_depth) {
+            /* not in a translated function, or never reached */
+            moved.at(i) = as_t<i32_t>(translator.out.size());
+            translator.out.push_back(inst);
+            continue;
+        }
+
+        if (inst.op == enter) {
+            /* sp is the caller's, enter makes it the new bp */
+            translator.slots.clear();
+            translator.sp_valid = true;
+        } else if (block_start.at(i)) {
+            if (live)
+                translator.write_all(inst.offset, depth.at(i));
+            translator.slots.resize(depth.at(i));
+            for (i32_t reg = 0; reg < depth.at(i); ++reg)
+                translator.slots.at(reg) = {false, reg};
+            translator.sp_valid = false;
+        }
+        auto first = i;
+        moved.at(i) = as_t<i32_t>(translator.out.size());
+        live = translator.translate(i, block_start);
+        for (auto merged = first + 1; merged <= i; ++merged)
+            moved.at(merged) = moved.at(first);
+    }
+
+    for (auto &inst: translator.out) {
+        if (is_code_address(inst.op) || inst.op == jit_r || inst.op == jif_r || inst.op == call_r)
+            inst.operand = moved.at(inst.operand);
+    }
+    program = std::move(translator.out);
+    move_program_indexes(moved);
+}
+
+/* register translation end */
+
+
+/* superinstructions start */
+
+/* with --ngrams, ngram_runs[i][n - 2] counts how often the n instructions
+ * ending at program[i] ran one after the other, without a jump between */
+bool count_ngrams = false;
+
+void VM::count_ngram(i32_t index) {
+    ngram_length = index == ngram_last + 1 ? ngram_length + 1 : 1;
+    ngram_last = index;
+    for (i32_t n = 2; n <= std::min(ngram_length, 4); ++n)
+        ++ngram_runs.at(index)[n - 2];
+}
+
+bool use_superinstructions = true;
+
+/* prints the counts of every sequence of 2 to 4 instructions as
+ * "count<tab>op op ...". bench/ngrams.sh adds these up over a set of
+ * scripts */
+void VM::print_ngrams() {
+    umap<string, u64_t> counts;
+    for (i32_t i = 0; i < as_t<i32_t>(ngram_runs.size()); ++i) {
+        string ngram = instructions[program.at(i).op];
+        for (i32_t n = 2; n <= 4 && ngram_runs.at(i)[n - 2] > 0; ++n) {
+            ngram = string(instructions[program.at(i - n + 1).op]) + ' ' + ngram;
+            counts[ngram] += ngram_runs.at(i)[n - 2];
+        }
+    }
+
+    vector<std::pair<string, u64_t>> sorted(counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end(), [](auto const &a, auto const &b) { return a.second > b.second; });
+    for (auto &[ngram, count]: sorted)
+        std::fprintf(stderr, "%llu\t%s\n", as_t<unsigned long long>(count), ngram.c_str());
+}
+
+/* the sequences below are the ones bench/ngrams.sh finds at the top. a
+ * superinstruction replaces only the first instruction of its sequence and
+ * skips over the others, which stay in place for jumps into the middle and
+ * for going back to the plain instructions */
+void VM::fuse() {
+    auto size = as_t<i32_t>(program.size());
+    auto op_at = [&](i32_t index) {
+        return index < size ? program.at(index).op : main_ret;
+    };
+
+    for (i32_t i = 0; i < size; ++i) {
+        auto &inst = program.at(i);
+        switch (inst.op) {
+            case get_local:
+                {
+                    auto second = op_at(i + 1);
+                    if (second != get_local && second != int_i)
+                        break;
+                    bool constant = second == int_i;
+
+                    auto third = op_at(i + 2);
+                    if (third == add && op_at(i + 3) == set_local && op_at(i + 4) == ipop) {
+                        inst.op = constant ? add_local_const : add_local_local;
+                        break;
+                    }
+
+                    /* the condition is popped on both ways out */
+                    if ((third != lt && third != lte && third != gt && third != gte) || op_at(i + 3) != jif
+                            || op_at(i + 4) != ipop || op_at(program.at(i + 3).operand) != ipop)
+                        break;
+                    auto compare = third == lt ? 0 : third == lte ? 1 : third == gt ? 2 : 3;
+                    inst.op = as_t<OpCode>((constant ? jif_local_lt_const : jif_local_lt_local) + compare);
+                }
+                break;
+            case pre_inc_local:
+                if (op_at(i + 1) == ipop)
+                    inst.op = inc_local_discard;
+                break;
+            case pre_dec_local:
+                if (op_at(i + 1) == ipop)
+                    inst.op = dec_local_discard;
+                break;
+            case ipop:
+                if (op_at(i + 1) == jump)
+                    inst.op = pop_jump;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* superinstructions end */
+
+
+/* jit start */
+
+#if NCC_JIT
+/* baseline jit for x86-64 linux. every function but main is turned into
+ * machine code that works on the same vm stack as the interpreter, with sp
+ * kept in rbx and bp in r12. constants, locals, calls, jumps and integer
+ * arithmetic are written out inline. every other instruction, and every
+ * operand kind the inline code does not expect, is run by the interpreter
+ * one instruction at a time */
+
+static_assert(std::is_same_v<decltype(VM::sp), Value *>, "the jit expects the vm stack pointer to be a Value *");
+static_assert(sizeof(Value) % 8 == 0, "the jit copies values eight bytes at a time");
+
+constexpr i32_t value_size = sizeof(Value);
+constexpr i32_t kind_offset = offsetof(Value, _kind);
+constexpr i32_t val_offset = offsetof(Value, _val);
+
+enum class Reg : u8_t {
+    rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+    r8, r9, r10, r11, r12, r13, r14, r15
+};
+
+enum Condition : u8_t {
+    cond_e = 0x4,
+    cond_ne = 0x5,
+    cond_l = 0xc,
+    cond_ge = 0xd,
+    cond_le = 0xe,
+    cond_g = 0xf
+};
+
+/* just enough of an x86-64 assembler for the jit. memory operands are
+ * always [base + disp32] */
+struct Assembler {
+    void byte(u8_t b) { bytes.push_back(b); }
+
+    void dword(u32_t d) {
+        for (i32_t i = 0; i < 4; ++i)
+            byte(as_t<u8_t>(d >> (i * 8)));
+    }
+
+    void qword(u64_t q) {
+        for (i32_t i = 0; i < 8; ++i)
+            byte(as_t<u8_t>(q >> (i * 8)));
+    }
+
+    i32_t here() { return as_t<i32_t>(bytes.size()); }
+
+    void rex(bool wide, Reg reg, Reg base, bool force = false) {
+        u8_t r = 0x40 | (wide << 3) | ((as_t<u8_t>(reg) >> 3) << 2) | (as_t<u8_t>(base) >> 3);
+        if (r != 0x40 || force)
+            byte(r);
+    }
+
+    void memory(Reg reg, Reg base, i32_t disp) {
+        byte(0x80 | ((as_t<u8_t>(reg) & 7) << 3) | (as_t<u8_t>(base) & 7));
+        if ((as_t<u8_t>(base) & 7) == 4)
+            byte(0x24);
+        dword(disp);
+    }
+
+    /* mov reg, imm64 */
+    void mov(Reg reg, u64_t imm) {
+        rex(true, Reg::rax, reg);
+        byte(0xb8 | (as_t<u8_t>(reg) & 7));
+        qword(imm);
+    }
+
+    /* mov reg, [base + disp] */
+    void load(Reg reg, Reg base, i32_t disp) {
+        rex(true, reg, base);
+        byte(0x8b);
+        memory(reg, base, disp);
+    }
+
+    /* mov [base + disp], reg */
+    void store(Reg base, i32_t disp, Reg reg) {
+        rex(true, reg, base);
+        byte(0x89);
+        memory(reg, base, disp);
+    }
+
+    /* mov byte [base + disp], al */
+    void store_al(Reg base, i32_t disp) {
+        rex(false, Reg::rax, base);
+        byte(0x88);
+        memory(Reg::rax, base, disp);
+    }
+
+    /* mov dword [base + disp], imm32 */
+    void store_dword(Reg base, i32_t disp, u32_t imm) {
+        rex(false, Reg::rax, base);
+        byte(0xc7);
+        memory(Reg::rax, base, disp);
+        dword(imm);
+    }
+
+    /* cmp dword [base + disp], imm32 */
+    void cmp_dword(Reg base, i32_t disp, u32_t imm) {
+        rex(false, Reg::rax, base);
+        byte(0x81);
+        memory(Reg::rdi, base, disp);
+        dword(imm);
+    }
+
+    /* cmp byte [base + disp], imm8 */
+    void cmp_byte(Reg base, i32_t disp, u8_t imm) {
+        rex(false, Reg::rax, base);
+        byte(0x80);
+        memory(Reg::rdi, base, disp);
+        byte(imm);
+    }
+
+    /* add/sub/imul/cmp reg, [base + disp] */
+    void add(Reg reg, Reg base, i32_t disp) { rex(true, reg, base); byte(0x03); memory(reg, base, disp); }
+    void sub(Reg reg, Reg base, i32_t disp) { rex(true, reg, base); byte(0x2b); memory(reg, base, disp); }
+    void imul(Reg reg, Reg base, i32_t disp) { rex(true, reg, base); byte(0x0f); byte(0xaf); memory(reg, base, disp); }
+    void cmp(Reg reg, Reg base, i32_t disp) { rex(true, reg, base); byte(0x3b); memory(reg, base, disp); }
+
+    /* add/sub reg, imm32 */
+    void add(Reg reg, i32_t imm) { rex(true, Reg::rax, reg); byte(0x81); byte(0xc0 | (as_t<u8_t>(reg) & 7)); dword(imm); }
+    void sub(Reg reg, i32_t imm) { rex(true, Reg::rax, reg); byte(0x81); byte(0xe8 | (as_t<u8_t>(reg) & 7)); dword(imm); }
+
+    /* op dest, src */
+    void mov(Reg dest, Reg src) { rex(true, src, dest); byte(0x89); byte(0xc0 | ((as_t<u8_t>(src) & 7) << 3) | (as_t<u8_t>(dest) & 7)); }
+    void sub(Reg dest, Reg src) { rex(true, src, dest); byte(0x29); byte(0xc0 | ((as_t<u8_t>(src) & 7) << 3) | (as_t<u8_t>(dest) & 7)); }
+
+    /* lea reg, [base + disp] */
+    void lea(Reg reg, Reg base, i32_t disp) {
+        rex(true, reg, base);
+        byte(0x8d);
+        memory(reg, base, disp);
+    }
+
+    void setcc(Condition cond) { byte(0x0f); byte(0x90 | cond); byte(0xc0); }
+    void test_al() { byte(0x84); byte(0xc0); }
+    void cmp_al(u8_t imm) { byte(0x3c); byte(imm); }
+    void push(Reg reg) { rex(false, Reg::rax, reg); byte(0x50 | (as_t<u8_t>(reg) & 7)); }
+    void pop(Reg reg) { rex(false, Reg::rax, reg); byte(0x58 | (as_t<u8_t>(reg) & 7)); }
+    void call_rax() { byte(0xff); byte(0xd0); }
+    void ret() { byte(0xc3); }
+
+    /* jumps and calls return the offset of their rel32, for patching */
+    i32_t jmp() { byte(0xe9); dword(0); return here() - 4; }
+    i32_t jcc(Condition cond) { byte(0x0f); byte(0x80 | cond); dword(0); return here() - 4; }
+    i32_t call() { byte(0xe8); dword(0); return here() - 4; }
+
+    void patch(i32_t at, i32_t target) {
+        u32_t rel = as_t<u32_t>(target - (at + 4));
+        for (i32_t i = 0; i < 4; ++i)
+            bytes.at(at + i) = as_t<u8_t>(rel >> (i * 8));
+    }
+
+    /* copies one Value from [src + src_disp] to [dest + dest_disp] through rcx */
+    void copy_value(Reg dest, i32_t dest_disp, Reg src, i32_t src_disp) {
+        for (i32_t i = 0; i < value_size; i += 8) {
+            load(Reg::rcx, src, src_disp + i);
+            store(dest, dest_disp + i, Reg::rcx);
+        }
+    }
+
+    vector<u8_t> bytes;
+};
+
+
+/* every call in compiled code is a native call as well. once this much of
+ * the native stack is used, calls are left to the interpreter, whose frames
+ * are only on the vm stack */
+constexpr u64_t jit_max_native_stack = 4 << 20;
+Value const jit_nil{};
+Value const jit_true{true};
+Value const jit_false{false};
+
+bool jit_step(VM *vm, Instruction *inst) {
+    vm->ip = vm->program.begin() + (inst - vm->program.data());
+    return vm->execute(true);
+}
+
+bool jit_truthy(Value *val) {
+    return val->as_bool();
+}
+
+bool jit_native_stack_low(VM *vm) {
+    char here;
+    return vm->jit_native_stack_base - reinterpret_cast<std::uintptr_t>(&here) > jit_max_native_stack;
+}
+
+/* what jit_enter_frame() did, 0 is a runtime error */
+constexpr u8_t jit_entered = 1;
+constexpr u8_t jit_interpreted = 2;
+
+/* with the native stack low, the whole call is run by the interpreter
+ * instead, in a frame that returns to jit_return. its sp and bp are then
+ * what a ret of the compiled code would have left */
+u8_t jit_enter_frame(VM *vm, Instruction *inst, i64_t arguments) {
+    if (jit_native_stack_low(vm)) {
+        vm->frames.push_back({vm->jit_return, as_t<i32_t>(vm->bp - vm->stack.data()), as_t<i32_t>(arguments)});
+        vm->ip = vm->program.begin() + (inst - vm->program.data());
+        return vm->execute(false) ? jit_interpreted : 0;
+    }
+    if (vm->stack.data() + vm->stack.size() - vm->sp < inst->operand && !vm->grow_stack(inst->operand, inst->offset))
+        return 0;
+    vm->bp = vm->sp;
+    return jit_entered;
+}
+
+struct JitCompiler {
+    explicit JitCompiler(VM &vm) : vm(vm) { }
+
+    VM &vm;     /* the code only ever runs on this one */
+    Assembler a;
+    i32_t error_exit = 0;
+    vector<i32_t> native;   /* native offset of every instruction in program, -1 if not compiled */
+    vector<std::pair<i32_t, i32_t>> jumps;  /* rel32 offset, target instruction */
+
+    void sync_out() {
+        a.mov(Reg::rax, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(&vm.sp)));
+        a.store(Reg::rax, 0, Reg::rbx);
+        a.mov(Reg::rax, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(&vm.bp)));
+        a.store(Reg::rax, 0, Reg::r12);
+    }
+
+    void sync_in() {
+        a.mov(Reg::rax, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(&vm.sp)));
+        a.load(Reg::rbx, Reg::rax, 0);
+        a.mov(Reg::rax, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(&vm.bp)));
+        a.load(Reg::r12, Reg::rax, 0);
+    }
+
+    void call_c(void const *function) {
+        a.mov(Reg::rax, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(function)));
+        a.call_rax();
+    }
+
+    /* calls jit_step() or jit_enter_frame(), which takes rdx as well */
+    void call_vm(Instruction &inst, void const *function) {
+        a.mov(Reg::rdi, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(&vm)));
+        a.mov(Reg::rsi, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(&inst)));
+        call_c(function);
+    }
+
+    /* hands a single instruction over to the interpreter */
+    void step(Instruction &inst) {
+        sync_out();
+        call_vm(inst, reinterpret_cast<void const *>(&jit_step));
+        a.test_al();
+        a.patch(a.jcc(cond_e), error_exit);
+        sync_in();
+    }
+
+    void push_constant(void const *val) {
+        a.mov(Reg::rax, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(val)));
+        a.copy_value(Reg::rbx, 0, Reg::rax, 0);
+        a.add(Reg::rbx, value_size);
+    }
+
+    /* jumps to slow when either of the two values on top is not an integer */
+    void both_int(vector<i32_t> &slow) {
+        a.cmp_dword(Reg::rbx, -2 * value_size + kind_offset, Int_v);
+        slow.push_back(a.jcc(cond_ne));
+        a.cmp_dword(Reg::rbx, -value_size + kind_offset, Int_v);
+        slow.push_back(a.jcc(cond_ne));
+        a.load(Reg::rax, Reg::rbx, -2 * value_size + val_offset);
+    }
+
+    void int_arithmetic(Instruction &inst) {
+        vector<i32_t> slow;
+        both_int(slow);
+        if (inst.op == add)
+            a.add(Reg::rax, Reg::rbx, -value_size + val_offset);
+        else if (inst.op == sub)
+            a.sub(Reg::rax, Reg::rbx, -value_size + val_offset);
+        else
+            a.imul(Reg::rax, Reg::rbx, -value_size + val_offset);
+        a.store(Reg::rbx, -2 * value_size + val_offset, Reg::rax);
+        a.sub(Reg::rbx, value_size);
+        auto done = a.jmp();
+        for (auto at: slow)
+            a.patch(at, a.here());
+        step(inst);
+        a.patch(done, a.here());
+    }
+
+    void int_comparison(Instruction &inst, Condition cond) {
+        vector<i32_t> slow;
+        both_int(slow);
+        a.cmp(Reg::rax, Reg::rbx, -value_size + val_offset);
+        a.setcc(cond);
+        a.store_al(Reg::rbx, -2 * value_size + val_offset);
+        a.store_dword(Reg::rbx, -2 * value_size + kind_offset, Bool_v);
+        a.sub(Reg::rbx, value_size);
+        auto done = a.jmp();
+        for (auto at: slow)
+            a.patch(at, a.here());
+        step(inst);
+        a.patch(done, a.here());
+    }
+
+    /* jit and jif leave the condition on the stack */
+    void conditional_jump(Instruction &inst, bool jump_if) {
+        Condition taken = jump_if ? cond_ne : cond_e;
+        a.cmp_dword(Reg::rbx, -value_size + kind_offset, Bool_v);
+        auto slow = a.jcc(cond_ne);
+        a.cmp_byte(Reg::rbx, -value_size + val_offset, 0);
+        jumps.push_back({a.jcc(taken), inst.operand});
+        auto done = a.jmp();
+        a.patch(slow, a.here());
+        a.lea(Reg::rdi, Reg::rbx, -value_size);
+        call_c(reinterpret_cast<void const *>(&jit_truthy));
+        a.test_al();
+        jumps.push_back({a.jcc(taken), inst.operand});
+        a.patch(done, a.here());
+    }
+
+    /* the entry point saves the callee saved registers and the native stack
+     * pointer, so that a runtime error anywhere can unwind straight back */
+    void trampoline() {
+        a.push(Reg::rbp);
+        a.push(Reg::rbx);
+        a.push(Reg::r12);
+        a.push(Reg::r13);
+        a.push(Reg::r14);
+        a.push(Reg::r15);
+        a.sub(Reg::rsp, 8);
+        a.mov(Reg::rax, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(&vm.jit_saved_rsp)));
+        a.store(Reg::rax, 0, Reg::rsp);
+        sync_in();
+        a.byte(0xff);   /* call rdi */
+        a.byte(0xd7);
+        sync_out();
+        a.byte(0xb8);   /* mov eax, 1 */
+        a.dword(1);
+        auto exit = a.here();
+        a.add(Reg::rsp, 8);
+        a.pop(Reg::r15);
+        a.pop(Reg::r14);
+        a.pop(Reg::r13);
+        a.pop(Reg::r12);
+        a.pop(Reg::rbx);
+        a.pop(Reg::rbp);
+        a.ret();
+
+        error_exit = a.here();
+        a.mov(Reg::rax, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(&vm.jit_saved_rsp)));
+        a.load(Reg::rsp, Reg::rax, 0);
+        a.byte(0x31);   /* xor eax, eax */
+        a.byte(0xc0);
+        a.patch(a.jmp(), exit);
+    }
+
+    /* r12 back to the caller's bp, see function() */
+    void caller_bp() {
+        a.pop(Reg::rax);
+        a.sub(Reg::r12, Reg::rax);
+    }
+
+    /* how far the caller's bp is below the new one is kept on the native
+     * stack, which also keeps it 16 byte aligned for calls. a distance
+     * stays right when grow_stack() moves the stack */
+    void function(i32_t entry, i32_t end, i32_t arguments) {
+        native.at(entry) = a.here();
+        a.mov(Reg::rax, Reg::rbx);
+        a.sub(Reg::rax, Reg::r12);
+        a.push(Reg::rax);
+        for (i32_t i = entry; i <= end; ++i) {
+            auto &inst = vm.program.at(i);
+            if (i != entry)
+                native.at(i) = a.here();
+            switch (inst.op) {
+                case int_c:
+                case char_c:
+                case double_c:
+                case string_c:
+                    push_constant(&vm.values.at(inst.operand));
+                    break;
+                case nil:
+                    push_constant(&jit_nil);
+                    break;
+                case true_l:
+                    push_constant(&jit_true);
+                    break;
+                case false_l:
+                    push_constant(&jit_false);
+                    break;
+                case get_local:
+                    a.copy_value(Reg::rbx, 0, Reg::r12, inst.operand * value_size);
+                    a.add(Reg::rbx, value_size);
+                    break;
+                case set_local:
+                    a.copy_value(Reg::r12, inst.operand * value_size, Reg::rbx, -value_size);
+                    break;
+                case get_global:
+                    push_constant(&vm.globals2.vals.at(inst.operand));
+                    break;
+                case set_global:
+                    a.mov(Reg::rax, as_t<u64_t>(reinterpret_cast<std::uintptr_t>(&vm.globals2.vals.at(inst.operand))));
+                    a.copy_value(Reg::rax, 0, Reg::rbx, -value_size);
+                    break;
+                case define_local:
+                case define_local_array:
+                    break;
+                case ipop:
+                    a.sub(Reg::rbx, value_size);
+                    break;
+                case enter: {
+                    sync_out();
+                    a.mov(Reg::rdx, as_t<u64_t>(arguments));
+                    call_vm(inst, reinterpret_cast<void const *>(&jit_enter_frame));
+                    a.test_al();
+                    a.patch(a.jcc(cond_e), error_exit);
+                    a.cmp_al(jit_interpreted);
+                    auto entered = a.jcc(cond_ne);
+                    /* the interpreter has run the call, bp is the caller's already */
+                    sync_in();
+                    a.pop(Reg::rax);
+                    a.ret();
+                    a.patch(entered, a.here());
+                    sync_in();
+                    break;
+                }
+                case add:
+                case sub:
+                case mult:
+                    int_arithmetic(inst);
+                    break;
+                case lt: int_comparison(inst, cond_l); break;
+                case lte: int_comparison(inst, cond_le); break;
+                case gt: int_comparison(inst, cond_g); break;
+                case gte: int_comparison(inst, cond_ge); break;
+                case eq: int_comparison(inst, cond_e); break;
+                case neq: int_comparison(inst, cond_ne); break;
+                case jit:
+                    conditional_jump(inst, true);
+                    break;
+                case jif:
+                    conditional_jump(inst, false);
+                    break;
+                case jump:
+                    /* a tail call goes into the callee with the native
+                     * stack as this function was entered with */
+                    if (vm.program.at(inst.operand).op == enter)
+                        caller_bp();
+                    jumps.push_back({a.jmp(), inst.operand});
+                    break;
+                case call:
+                    jumps.push_back({a.call(), inst.operand});
+                    break;
+                case ret:
+                    /* the value goes where the first argument was */
+                    a.copy_value(Reg::r12, -arguments * value_size, Reg::rbx, -value_size);
+                    a.lea(Reg::rbx, Reg::r12, (1 - arguments) * value_size);
+                    caller_bp();
+                    a.ret();
+                    break;
+                default:
+                    step(inst);
+                    break;
+            }
+        }
+    }
+};
+
+bool jit_unsupported(OpCode op) {
+    switch (op) {
+        case get_str:
+        case local_get_s_ref:
+        case load_global_ref:
+        case get_global_ref:
+        case set_global_ref:
+        case get_arg_array_ref:
+        case set_arg_array_ref:
+        case main_ret:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* compiles every function that can be compiled and turns calls to them in
+ * program into jit_call */
+void VM::jit_compile() {
+    pool_immediates();
+    /* before any instruction is compiled in, compiled code points into program */
+    jit_return = as_t<i32_t>(program.size());
+    program.push_back({main_ret, 0, 0, as_t<i32_t>(code.size())});
+
+    struct Range {
+        i32_t entry;
+        i32_t end;
+        i32_t arguments;
+        bool compiled;
+    };
+    vector<Range> ranges;
+    vector<i32_t> function_at(program.size(), -1);
+
+    for (auto &function: functions.functions) {
+        i32_t entry = program_index(function.address);
+        i32_t end = function_end(function);
+        function_at.at(entry) = as_t<i32_t>(ranges.size());
+        ranges.push_back({entry, end, function.arguments, program.at(end).op == ret});
+    }
+
+    /* a call, or a tail call, which jumps to the enter of the callee */
+    auto calls = [this](Instruction const &inst) {
+        return inst.op == call || (inst.op == jump && program.at(inst.operand).op == enter);
+    };
+
+    for (auto &range: ranges) {
+        for (i32_t i = range.entry; i <= range.end && range.compiled; ++i) {
+            auto &inst = program.at(i);
+            if (jit_unsupported(inst.op)) {
+                range.compiled = false;
+            } else if (calls(inst)) {
+                range.compiled = function_at.at(inst.operand) != -1;
+            } else if (inst.op == jit || inst.op == jif || inst.op == jump) {
+                range.compiled = inst.operand >= range.entry && inst.operand <= range.end;
+            }
+        }
+    }
+
+    /* a function that calls a function that is not compiled is not
+     * compiled either */
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto &range: ranges) {
+            for (i32_t i = range.entry; i <= range.end && range.compiled; ++i) {
+                auto &inst = program.at(i);
+                if (calls(inst) && function_at.at(inst.operand) != -1 &&
+                        !ranges.at(function_at.at(inst.operand)).compiled) {
+                    range.compiled = false;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    JitCompiler compiler{*this};
+    compiler.native.assign(program.size(), -1);
+    compiler.trampoline();
+    for (auto &range: ranges) {
+        if (range.compiled)
+            compiler.function(range.entry, range.end, range.arguments);
+    }
+    for (auto &jump: compiler.jumps)
+        compiler.a.patch(jump.first, compiler.native.at(jump.second));
+
+    auto &bytes = compiler.a.bytes;
+    void *memory = mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return;
+    std::memcpy(memory, bytes.data(), bytes.size());
+    if (mprotect(memory, bytes.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, bytes.size());
+        return;
+    }
+
+    jit_code = memory;
+    jit_code_size = bytes.size();
+    auto base = as_ptr<u8_t>(memory);
+    jit_enter = reinterpret_cast<JitEntry>(base);
+    for (i32_t i = 0; i < as_t<i32_t>(program.size()); ++i) {
+        auto &inst = program.at(i);
+        if (inst.op != call)
+            continue;
+        auto function = function_at.at(inst.operand);
+        if (function == -1 || !ranges.at(function).compiled)
+            continue;
+        inst.op = jit_call;
+        inst.operand = as_t<i32_t>(jit_functions.size());
+        jit_functions.push_back(base + compiler.native.at(ranges.at(function).entry));
+        jit_targets.push_back(ranges.at(function).entry);
+    }
+}
+
+/* instructions stepped by compiled code move ip, so the caller's ip is put
+ * back afterwards. when the interpreter runs a call for compiled code, the
+ * calls it meets are its own, so the native stack does not grow any more */
+bool VM::jit_run(Instruction const &inst) {
+    char here;
+    bool outermost = jit_native_stack_base == 0;
+    if (outermost)
+        jit_native_stack_base = reinterpret_cast<std::uintptr_t>(&here);
+    else if (jit_native_stack_low(this)) {
+        push_frame({call, inst.count, jit_targets.at(inst.operand), inst.offset});
+        return true;
+    }
+
+    auto save_ip = ip;
+    auto ok = jit_enter(jit_functions.at(inst.operand));
+    ip = save_ip;
+
+    if (outermost)
+        jit_native_stack_base = 0;
+    return ok;
+}
+#else
+void VM::jit_compile() { }
+
+bool VM::jit_run(Instruction const &inst) {
+    return false;
+}
+#endif
+
+/* jit end */
 
 
 /* runtime start */
 
-void runtime_error(char const *message, int offset) {
+void VM::runtime_error(char const *message, int offset) {
     auto lineNo = lines.at(offset);
     error_header(lineNo);
     std::fprintf(stderr, "%s\n\t", message);
 
-    auto &error_line = sourcecode.at(lineNo - 1);
+    auto &error_line = compiler.source_line(lineNo - 1);
     std::fprintf(stderr, BOLD_GREEN "%d" NORMAL "| %.*s\n\n", lineNo, error_line.length, error_line.text);
 }
 
-void push(i64_t val) {
+/* makes room for size more values above sp. the stack only grows when a
+ * function is entered, where sp and bp are the only pointers into it */
+bool VM::grow_stack(i32_t size, i32_t offset) {
+    auto used = sp - stack.data();
+    auto base = bp - stack.data();
+    if (used + size > max_stack_size) {
+        runtime_error("stack overflow", offset);
+        return false;
+    }
+
+    stack.resize(std::min<i64_t>(max_stack_size, std::max<i64_t>(used + size, 2 * stack.size())));
+    sp = stack.data() + used;
+    bp = stack.data() + base;
+    return true;
+}
+
+void VM::push(i64_t val) {
     *sp = val;
     ++sp;
 }
 
-void push(char val) {
+void VM::push(char val) {
     *sp = val;
     ++sp;
 }
 
-void push(double val) {
+void VM::push(double val) {
     *sp = val;
     ++sp;
 }
 
-void push(nullptr_t val) {
+void VM::push(nullptr_t val) {
     *sp = val;
     ++sp;
 }
 
-void push(bool val) {
+void VM::push(bool val) {
     *sp = val;
     ++sp;
 }
 
-void push(StringLiteral val) {
+void VM::push(StringLiteral val) {
     *sp = val;
     ++sp;
 }
 
-void push(char const *text, i32_t length) {
+void VM::push(char const *text, i32_t length) {
     *sp = StringLiteral{text, length};
     ++sp;
 }
 
-void push(Value &val) {
-    if (val.is_nil())
-        push(nullptr);
-    else if (val.is_bool())
-        push(val.as_bool());
-    else if (val.is_char())
-        push(val.as_char());
-    else if (val.is_int())
-        push(val.as_int());
-    else if (val.is_double())
-        push(val.as_double());
-    else if (val.is_string()) {
-        *sp = val.as_string();
-        ++sp;
-    }
+void VM::push(Value &val) {
+    *sp = val;
+    ++sp;
 }
 
-Value nil_value{};
-Value &pop() {
-    if (sp == stack.begin())
+Value &VM::pop() {
+    if (sp == stack.data())
         return nil_value;
     sp -= 1;
     return *sp;
 }
 
-Value &peek(i32_t offset = 0) {
+Value &VM::peek(i32_t offset) {
     return *(sp - 1 - offset);
 }
 
+/* a call from inst, which ip has already moved past. enter, where the
+ * call goes, checks how deep the calls are */
+void VM::push_frame(Instruction const &inst) {
+    frames.push_back({as_t<i32_t>(ip - program.begin()), as_t<i32_t>(bp - stack.data()), inst.count});
+    ip = program.begin() + inst.operand;
+}
+
+/* back to the caller of the frame on top, which gets val where the first
+ * argument was */
+void VM::pop_frame(Value val) {
+    auto &frame = frames.back();
+    sp = bp - frame.arguments;
+    bp = stack.data() + frame.bp;
+    ip = program.begin() + frame.return_ip;
+    frames.pop_back();
+    push(val);
+}
+
+
+/* everything the register forms of the binary instructions do, besides
+ * the integer case that is done inline in execute() */
+bool VM::register_binary(OpCode op, Value val1, Value val2, Value &result, i32_t offset) {
+    switch (op) {
+        case add_r:
+        case sub_r:
+        case mult_r:
+        case idiv_r:
+        case mod_r:
+            if (val1.kind() != val2.kind() || (!val1.is_int() && !val1.is_double())) {
+                runtime_error("both operands have to be <integer> or <double>", offset);
+                return false;
+            }
+            if (val1.is_int()) {
+                auto a = val1.as_int();
+                auto b = val2.as_int();
+                result = op == add_r ? a + b : op == sub_r ? a - b : op == mult_r ? a * b : op == idiv_r ? a / b : a % b;
+            } else {
+                auto a = val1.as_double();
+                auto b = val2.as_double();
+                result = op == add_r ? a + b : op == sub_r ? a - b : op == mult_r ? a * b : op == idiv_r ? a / b : std::fmod(a, b);
+            }
+            return true;
+        case lt_r:
+        case lte_r:
+        case gt_r:
+        case gte_r:
+            if (val1.kind() != val2.kind() || (!val1.is_int() && !val1.is_double() && !val1.is_char())) {
+                runtime_error("both operands have to be <integer> or <double> or <character>", offset);
+                return false;
+            }
+            if (val1.is_double()) {
+                auto a = val1.as_double();
+                auto b = val2.as_double();
+                result = op == lt_r ? std::isless(a, b) : op == lte_r ? std::islessequal(a, b)
+                    : op == gt_r ? std::isgreater(a, b) : std::isgreaterequal(a, b);
+            } else {
+                auto a = val1.is_int() ? val1.as_int() : as_t<i64_t>(val1.as_char());
+                auto b = val2.is_int() ? val2.as_int() : as_t<i64_t>(val2.as_char());
+                result = op == lt_r ? a < b : op == lte_r ? a <= b : op == gt_r ? a > b : a >= b;
+            }
+            return true;
+        case eq_r:
+        case neq_r:
+            {
+                if (val1.kind() != val2.kind()) {
+                    runtime_error("operands have to be of same type", offset);
+                    return false;
+                }
+                bool equal = same_value(val1, val2);
+                result = op == eq_r ? equal : !equal;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
 
-void print_function() {
-    auto print_args = *ip++;
+void VM::print_function(u8_t print_args) {
     auto pop_n = print_args;
     while (print_args--) {
         peek(print_args).print();
@@ -3550,25 +7178,27 @@ void print_function() {
 }
 
 
-bool run_vm() {
+/* runs the program from ip until main returns, or only the instruction at
+ * ip when single_step is set */
+bool VM::execute(bool single_step) {
 #define arithmatic_type_check() \
-    if (peek()._kind != peek(1)._kind || \
+    if (peek().kind() != peek(1).kind() || \
             (!peek().is_int() && !peek().is_double())) {\
-        runtime_error("both operands have to be <integer> or <double>", offset);\
+        runtime_error("both operands have to be <integer> or <double>", inst->offset);\
         return false;\
     }
 
 #define addition_type_check() \
-    if (peek()._kind != peek(1)._kind || \
+    if (peek().kind() != peek(1).kind() || \
             (!peek().is_int() && !peek().is_double())) {\
-        runtime_error("both operands have to be <integer> or <double>", offset);\
+        runtime_error("both operands have to be <integer> or <double>", inst->offset);\
         return false;\
     }
 
 #define relational_type_check() \
-    if (peek()._kind != peek(1)._kind || \
+    if (peek().kind() != peek(1).kind() || \
             (!peek().is_int() && !peek().is_double() && !peek().is_char())) {\
-        runtime_error("both operands have to be <integer> or <double> or <character>", offset);\
+        runtime_error("both operands have to be <integer> or <double> or <character>", inst->offset);\
         return false;\
     }
 
@@ -3580,6 +7210,24 @@ bool run_vm() {
     else if (val1.is_double())\
     push(val1.as_double() op val2.as_double());
 
+/* remembers the kinds of the operands, so the next run of this
+ * instruction can skip the checks above */
+#define quicken(val, int_form, double_form) \
+    if (val.is_small_int())\
+    inst->op = int_form;\
+    else if (val.is_double())\
+    inst->op = double_form;
+
+/* a quickened instruction only checks for the kind it was made for and
+ * goes back to its generic form when that does not hold */
+#define quickened_operation(generic, is_kind, as_kind, oper) \
+    if (!peek().is_kind() || !peek(1).is_kind()) {\
+        inst->op = generic;\
+        goto label_##generic;\
+    }\
+    *(sp - 2) = peek(1).as_kind() oper peek().as_kind();\
+    --sp;
+
 #define relational_operation(op) \
     val2 = pop();\
     val1 = pop();\
@@ -3589,71 +7237,266 @@ bool run_vm() {
     push(val1.as_char() op val2.as_char());
 
 #define equality_operation(op) \
-    if (peek()._kind != peek(1)._kind) {\
-        runtime_error("operands have to be of same type", offset);\
+    if (peek().kind() != peek(1).kind()) {\
+        runtime_error("operands have to be of same type", inst->offset);\
         return false;\
     }\
     val2 = pop();\
     val1 = pop();\
-    if (val1.is_int())\
-    push(val1.as_int() op val2.as_int());\
-    else if (val1.is_char())\
-    push(val2.as_char() op val1.as_char());\
-    else if (val1.is_double())\
-    push(std::fabs(val1.as_double() - val2.as_double()) op 0.0);\
-    else if (val1.is_bool())\
-    push(val1.as_bool() op val2.as_bool());
+    push(same_value(val1, val2) op true);
+
+
+/* a superinstruction that finds operands it was not made for turns back
+ * into the first instruction of its sequence */
+#define unfuse(generic) \
+    inst->op = generic;\
+    goto label_##generic;
+
+/* get_local, second, compare, jif, ipop. the condition never gets on the
+ * stack, so the ipop after jif and the one at its target are skipped */
+#define fused_jif(second, oper) \
+    {\
+        auto &a = *(bp + inst->operand);\
+        auto &&b = second;\
+        if (!a.is_small_int() || !b.is_small_int()) {\
+            unfuse(get_local);\
+        }\
+        if (a.as_small_int() oper b.as_small_int())\
+        ip = inst + 5;\
+        else\
+        ip = program.begin() + inst[3].operand + 1;\
+    }
+
+/* get_local, second, add, set_local, ipop */
+#define fused_add(second) \
+    {\
+        auto &a = *(bp + inst->operand);\
+        auto &&b = second;\
+        if (!a.is_small_int() || !b.is_small_int()) {\
+            unfuse(get_local);\
+        }\
+        *(bp + inst[3].operand) = a.as_small_int() + b.as_small_int();\
+        ip = inst + 5;\
+    }
+
+/* operand 1 or 2 of a register form */
+#define register_operand(n) \
+    ((inst->count & (n)) ? values[inst->src##n] : *(bp + inst->src##n))
+
+#define register_operation(oper) \
+    {\
+        auto &a = register_operand(1);\
+        auto &b = register_operand(2);\
+        if (a.is_int() && b.is_int())\
+        *(bp + inst->operand) = a.as_int() oper b.as_int();\
+        else if (!register_binary(inst->op, a, b, *(bp + inst->operand), inst->offset))\
+        return false;\
+    }
 
-    
-    bool has_globals = false;
-    i32_t i = 0;
-global_execution:
-    for ( ; i < i32_t(global_codes.size()); ) {
-        ip = vector<u8_t>::iterator(code.begin() + global_codes.at(i));
-        has_globals = true;
-        ++i;
-        goto runtime_start;
+#if NCC_THREADED_DISPATCH
+    /* one label per opcode, in the same order as enum OpCode */
+    static void *dispatch_table[] = {
+        &&label_int_c,
+        &&label_char_c,
+        &&label_double_c,
+        &&label_string_c,
+        &&label_int_i,
+        &&label_add,
+        &&label_sub,
+        &&label_mult,
+        &&label_idiv,
+        &&label_positive,
+        &&label_neg,
+        &&label_nil,
+        &&label_true_l,
+        &&label_false_l,
+        &&label_lt,
+        &&label_lte,
+        &&label_gt,
+        &&label_gte,
+        &&label_eq,
+        &&label_inot,
+        &&label_neq,
+        &&label_logical_and,
+        &&label_logical_or,
+        &&label_pre_inc,
+        &&label_pre_dec,
+        &&label_pre_inc_local,
+        &&label_pre_dec_local,
+        &&label_pre_inc_local_array,
+        &&label_pre_dec_local_array,
+        &&label_mod,
+        &&label_jit,
+        &&label_jif,
+        &&label_jump,
+        &&label_ipop,
+        &&label_enter,
+        &&label_call,
+        &&label_print,
+        &&label_local_get_c,
+        &&label_local_get_i,
+        &&label_local_get_s,
+        &&label_local_get_d,
+        &&label_get_c,
+        &&label_get_i,
+        &&label_unhandled,  /* get_str */
+        &&label_get_d,
+        &&label_local_get_c_ref,
+        &&label_local_get_i_ref,
+        &&label_unhandled,  /* local_get_s_ref */
+        &&label_local_get_d_ref,
+        &&label_define_global,
+        &&label_define_local,
+        &&label_set_global,
+        &&label_get_global,
+        &&label_set_local,
+        &&label_get_local,
+        &&label_load_local_ref,
+        &&label_get_local_ref,
+        &&label_set_local_ref,
+        &&label_unhandled,  /* load_global_ref */
+        &&label_unhandled,  /* get_global_ref */
+        &&label_unhandled,  /* set_global_ref */
+        &&label_define_local_array,
+        &&label_get_local_array,
+        &&label_set_local_array,
+        &&label_local_array_get_c,
+        &&label_local_array_get_i,
+        &&label_local_array_get_d,
+        &&label_set_string,
+        &&label_set_string_index,
+        &&label_get_string,
+        &&label_load_array_ref,
+        &&label_get_array_ref,
+        &&label_set_array_ref,
+        &&label_load_arg_array_ref,
+        &&label_unhandled,  /* get_arg_array_ref */
+        &&label_unhandled,  /* set_arg_array_ref */
+        &&label_cast_to_int,
+        &&label_cast_to_double,
+        &&label_cast_to_char,
+        &&label_cast_to_bool,
+        &&label_add_int_int,
+        &&label_sub_int_int,
+        &&label_mult_int_int,
+        &&label_idiv_int_int,
+        &&label_mod_int_int,
+        &&label_lt_int_int,
+        &&label_lte_int_int,
+        &&label_gt_int_int,
+        &&label_gte_int_int,
+        &&label_eq_int_int,
+        &&label_neq_int_int,
+        &&label_add_double_double,
+        &&label_sub_double_double,
+        &&label_mult_double_double,
+        &&label_idiv_double_double,
+        &&label_lt_double_double,
+        &&label_lte_double_double,
+        &&label_gt_double_double,
+        &&label_gte_double_double,
+        &&label_jif_local_lt_const,
+        &&label_jif_local_lte_const,
+        &&label_jif_local_gt_const,
+        &&label_jif_local_gte_const,
+        &&label_jif_local_lt_local,
+        &&label_jif_local_lte_local,
+        &&label_jif_local_gt_local,
+        &&label_jif_local_gte_local,
+        &&label_add_local_const,
+        &&label_add_local_local,
+        &&label_inc_local_discard,
+        &&label_dec_local_discard,
+        &&label_pop_jump,
+        &&label_jit_call,
+        &&label_move_r,
+        &&label_add_r,
+        &&label_sub_r,
+        &&label_mult_r,
+        &&label_idiv_r,
+        &&label_mod_r,
+        &&label_lt_r,
+        &&label_lte_r,
+        &&label_gt_r,
+        &&label_gte_r,
+        &&label_eq_r,
+        &&label_neq_r,
+        &&label_jit_r,
+        &&label_jif_r,
+        &&label_inc_r,
+        &&label_dec_r,
+        &&label_call_r,
+        &&label_ret_r,
+        &&label_set_sp,
+        &&label_ret,
+        &&label_main_ret,
+    };
+    static_assert(sizeof(dispatch_table) / sizeof(*dispatch_table) == main_ret + 1,
+            "dispatch_table is out of sync with enum OpCode");
+
+#define vm_case(op) case op: label_##op
+#define vm_target(op) vm_case(op)
+
+/* when tracing or single stepping, every instruction has to go back through
+ * the top of the loop, otherwise jump straight to the next handler */
+#define dispatch() \
+    if (stepping) break; \
+    else { \
+        inst = ip++; \
+        goto *dispatch_table[inst->op]; \
     }
+#else
+#define vm_case(op) case op
+/* the generic forms quickened and fused instructions go back to */
+#define vm_target(op) case op: label_##op
+#define dispatch() break
+#endif
 
-    has_globals = false;
-    ip = code.begin() + main_addr;
+#if NCC_THREADED_DISPATCH
+    bool stepping = single_step || show_opcodes || count_ngrams;
+#endif
+    vector<Instruction>::iterator inst;
 
     while (true) {
-runtime_start:
-        auto offset = as_t<i32_t>(ip - code.begin());
+        if (count_ngrams)
+            count_ngram(as_t<i32_t>(ip - program.begin()));
         if (show_opcodes) {
+            auto offset = ip->offset;
             std::fprintf(stderr, "\t\t\t\t\t\t\t\tstack = [ ");
-            for (auto i = stack.begin(); i != sp; ++i) {
+            for (auto i = stack.data(); i != sp; ++i) {
                 (*i).print(stderr, false);
                 std::fprintf(stderr, " ");
             }
             std::fprintf(stderr, "]\n");
-            disassemble_instruction(offset);
+            if (ip->op >= move_r && ip->op <= set_sp)
+                disassemble_register(*ip);
+            else if (ip->op >= jif_local_lt_const && ip->op <= pop_jump)
+                std::fprintf(stderr, "%04d\t%4d\t%20s\n", offset, lines.at(offset), instructions[ip->op]);
+            else
+                compiler.disassemble_instruction(offset);
         }
 
-        auto instruction = as_t<OpCode>(*ip++);
+        inst = ip++;
         Value val1;
         Value val2;
-        char temp[1000];
         i32_t temp_length = 0;
-        switch (instruction) {
-            case int_c:
-                push(values.at(get_double_byte_index(ip - code.begin())).as_int());
-                ip += 2;
-                break;
-            case char_c:
-                push(values.at(get_double_byte_index(ip - code.begin())).as_char());
-                ip += 2;
-                break;
-            case double_c:
-                push(values.at(get_double_byte_index(ip - code.begin())).as_double());
-                ip += 2;
-                break;
-            case string_c:
-                push(values.at(get_double_byte_index(ip - code.begin())).as_string());
-                ip += 2;
-                break;
-            case add:
+        switch (inst->op) {
+            vm_case(int_c):
+                push(values.at(inst->operand).as_int());
+                dispatch();
+            vm_case(char_c):
+                push(values.at(inst->operand).as_char());
+                dispatch();
+            vm_case(double_c):
+                push(values.at(inst->operand).as_double());
+                dispatch();
+            vm_case(string_c):
+                push(values.at(inst->operand));
+                dispatch();
+            vm_case(int_i):
+                push(as_t<i64_t>(inst->operand));
+                dispatch();
+            vm_target(add):
                 addition_type_check();
 
                 val2 = pop();
@@ -3662,94 +7505,103 @@ runtime_start:
                     push(val1.as_int() + val2.as_int());
                 else if (val1.is_double())
                     push(val1.as_double() + val2.as_double());
-                break;
-            case sub:
+                quicken(val1, add_int_int, add_double_double);
+                dispatch();
+            vm_target(sub):
                 arithmatic_type_check();
 
                 arithmatic_operation(-);
-                break;
-            case mult:
+                quicken(val1, sub_int_int, sub_double_double);
+                dispatch();
+            vm_target(mult):
                 arithmatic_type_check();
 
                 arithmatic_operation(*);
-                break;
-            case idiv:
+                quicken(val1, mult_int_int, mult_double_double);
+                dispatch();
+            vm_target(idiv):
                 arithmatic_type_check();
 
                 arithmatic_operation(/);
-                break;
-            case positive:
+                quicken(val1, idiv_int_int, idiv_double_double);
+                dispatch();
+            vm_case(positive):
                 if (!peek().is_int())
                     return false;
-                break;
-            case neg:
+                dispatch();
+            vm_case(neg):
                 if (!peek().is_int())
                     return false;
                 *(sp - 1) = -(*(sp - 1)).as_int();
-                break;
-            case nil:
+                dispatch();
+            vm_case(nil):
                 push(nullptr);
-                break;
-            case true_l:
+                dispatch();
+            vm_case(true_l):
                 push(true);
-                break;
-            case false_l:
+                dispatch();
+            vm_case(false_l):
                 push(false);
-                break;
-            case lt:
+                dispatch();
+            vm_target(lt):
                 relational_type_check();
 
                 relational_operation(<)
                 else if (val1.is_double())
                     push(std::isless(val1.as_double(), val2.as_double()));
-                break; 
-            case lte:
+                quicken(val1, lt_int_int, lt_double_double);
+                dispatch();
+            vm_target(lte):
                 relational_type_check();
 
                 relational_operation(<=)
                 else if (val1.is_double())
                     push(std::islessequal(val1.as_double(), val2.as_double()));
-                break;
-            case gt:
+                quicken(val1, lte_int_int, lte_double_double);
+                dispatch();
+            vm_target(gt):
                 relational_type_check();
 
                 relational_operation(>)
                 else if (val1.is_double())
                     push(std::isgreater(val1.as_double(), val2.as_double()));
-                break;
-            case gte:
+                quicken(val1, gt_int_int, gt_double_double);
+                dispatch();
+            vm_target(gte):
                 relational_type_check();
 
                 relational_operation(>=)
                 else if (val1.is_double())
                     push(std::isgreaterequal(val1.as_double(), val2.as_double()));
-                break;
-            case eq:
+                quicken(val1, gte_int_int, gte_double_double);
+                dispatch();
+            vm_target(eq):
                 equality_operation(==);
-                break;
-            case inot:
+                quicken(val1, eq_int_int, eq);
+                dispatch();
+            vm_case(inot):
                 push(!pop().as_bool());
-                break;
-            case neq:
+                dispatch();
+            vm_target(neq):
                 equality_operation(!=);
-                break;
-            case logical_and:
+                quicken(val1, neq_int_int, neq);
+                dispatch();
+            vm_case(logical_and):
                 val2 = pop();
                 val1 = pop();
                 push(val1.as_bool() && val2.as_bool());
-                break;
-            case logical_or:
+                dispatch();
+            vm_case(logical_or):
                 val2 = pop();
                 val1 = pop();
                 push(val1.as_bool() || val2.as_bool());
-                break;
-            case pre_inc:
+                dispatch();
+            vm_case(pre_inc):
                 { 
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     auto &val = globals2[index];
                     if (!val.is_int() && !val.is_double()) {
-                        runtime_error("'++' operator expectd operand of type <integer> or <double>", offset);
+                        runtime_error("'++' operator expectd operand of type <integer> or <double>", inst->offset);
                         return false;
                     }
 
@@ -3760,14 +7612,13 @@ runtime_start:
                     }
                     push(val);
                 }
-                break;
-            case pre_dec:
+                dispatch();
+            vm_case(pre_dec):
                 { 
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     auto &val = globals2[index];
                     if (!val.is_int() && !val.is_double()) {
-                        runtime_error("'--' operator expectd operand of type <integer> or <double>", offset);
+                        runtime_error("'--' operator expectd operand of type <integer> or <double>", inst->offset);
                         return false;
                     }
 
@@ -3778,14 +7629,13 @@ runtime_start:
                     }
                     push(val);
                 }
-                break;
-            case pre_inc_local:
+                dispatch();
+            vm_target(pre_inc_local):
                 { 
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     auto &val = *(bp + index);
                     if (!val.is_int() && !val.is_double()) {
-                        runtime_error("'++' operator expectd operand of type <integer> or <double>", offset);
+                        runtime_error("'++' operator expectd operand of type <integer> or <double>", inst->offset);
                         return false;
                     }
 
@@ -3796,14 +7646,13 @@ runtime_start:
                     }
                     push(val);
                 }
-                break;
-            case pre_dec_local:
+                dispatch();
+            vm_target(pre_dec_local):
                 { 
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     auto &val = *(bp + index);
                     if (!val.is_int() && !val.is_double()) {
-                        runtime_error("'--' operator expectd operand of type <integer> or <double>", offset);
+                        runtime_error("'--' operator expectd operand of type <integer> or <double>", inst->offset);
                         return false;
                     }
 
@@ -3814,25 +7663,24 @@ runtime_start:
                     }
                     push(val);
                 }
-                break;
-            case pre_inc_local_array:
+                dispatch();
+            vm_case(pre_inc_local_array):
                 { 
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek().is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
 
                     auto array_index = pop().as_int();
                     if (array_index >= count) {
-                        runtime_error("out of range index", offset);
+                        runtime_error("out of range index", inst->offset);
                         return false;
                     }
                     auto &val = *(bp + index + array_index);
                     if (!val.is_int() && !val.is_double()) {
-                        runtime_error("'--' operator expectd operand of type <integer> or <double>", offset);
+                        runtime_error("'--' operator expectd operand of type <integer> or <double>", inst->offset);
                         return false;
                     }
 
@@ -3843,25 +7691,24 @@ runtime_start:
                     }
                     push(val);
                 }
-                break;
-            case pre_dec_local_array:
+                dispatch();
+            vm_case(pre_dec_local_array):
                 { 
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek().is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
 
                     auto array_index = pop().as_int();
                     if (array_index >= count) {
-                        runtime_error("out of range index", offset);
+                        runtime_error("out of range index", inst->offset);
                         return false;
                     }
                     auto &val = *(bp + index + array_index);
                     if (!val.is_int() && !val.is_double()) {
-                        runtime_error("'--' operator expectd operand of type <integer> or <double>", offset);
+                        runtime_error("'--' operator expectd operand of type <integer> or <double>", inst->offset);
                         return false;
                     }
 
@@ -3872,8 +7719,8 @@ runtime_start:
                     }
                     push(val);
                 }
-                break;
-            case mod:
+                dispatch();
+            vm_target(mod):
                 arithmatic_type_check();
 
                 val2 = pop();
@@ -3882,141 +7729,109 @@ runtime_start:
                     push(val1.as_int() % val2.as_int());
                 else if (val1.is_double())
                     push(std::fmod(val1.as_double(), val2.as_double()));
-                break;
-            case jit:
+                quicken(val1, mod_int_int, mod);
+                dispatch();
+            vm_case(jit):
                 {
                     val1 = peek();
-                    if (val1.as_bool()) {
-                        auto index = get_double_byte_index(ip - code.begin());
-                        ip = code.begin() + index;
-                    } else {
-                        ip += 2;
-                    }
+                    if (val1.as_bool())
+                        ip = program.begin() + inst->operand;
                 }
-                break;
-            case jif:
+                dispatch();
+            vm_case(jif):
                 {
                     val1 = peek();
-                    if (!val1.as_bool()) {
-                        auto index = get_double_byte_index(ip - code.begin());
-                        ip = code.begin() + index;
-                    } else {
-                        ip += 2;
-                    }
+                    if (!val1.as_bool())
+                        ip = program.begin() + inst->operand;
                 }
-                break;
-            case jump:
+                dispatch();
+            vm_case(jump):
                 {
-                    ip = code.begin() + get_double_byte_index(ip - code.begin());
+                    ip = program.begin() + inst->operand;
                 }
-                break;
-            case ipop:
+                dispatch();
+            vm_case(ipop):
                 pop();
-                break;
-            case ipush_bp:
-                push(as_t<i64_t>(bp - stack.begin()));
-                bp = sp;
-                break;
-            case ipop_bp:
-                {
-                    auto index = (*(sp - 1)).as_int();
-                    bp = stack.begin() + index;
-                    --sp;
-                }
-                break;
-            case ret_addr:
-                {
-                    auto addr = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    push(as_t<i64_t>(addr));
+                dispatch();
+            vm_case(enter):
+                if (as_t<i32_t>(frames.size()) > max_call_depth) {
+                    runtime_error("stack overflow", inst->offset);
+                    return false;
                 }
-                break;
-            case push_arg_addr:
-                push(as_t<i64_t>(argument_indexes.at(get_double_byte_index(ip - code.begin()))));
-                ip += 2;
-                break;
-            case pop_arg_addr:
-                argument_indexes.at(get_double_byte_index(ip - code.begin())) = pop().as_int();
-                ip += 2;
-                break;
-            case set_arg_addr:
-                argument_indexes.at(get_double_byte_index(ip - code.begin())) = sp - stack.begin();
-                ip += 2;
-                break;             
-            case print:
-                print_function();
-                break;
-            case get_c:
+                if (stack.data() + stack.size() - sp < inst->operand && !grow_stack(inst->operand, inst->offset))
+                    return false;
+                bp = sp;
+                dispatch();
+            vm_case(call):
+                push_frame(*inst);
+                dispatch();
+            vm_case(print):
+                print_function(inst->count);
+                dispatch();
+            vm_case(get_c):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     globals2[index] = as_t<char>(std::getchar());
                 }
-                break;
-            case get_i:
+                dispatch();
+            vm_case(get_i):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     i64_t in;
                     
                     if (!get_integer(in)) {
-                        runtime_error("invalid integer input", offset);
+                        runtime_error("invalid integer input", inst->offset);
                         return false; 
                     }
 
                     globals2[index] = in;
                 }
-                break;
-            case get_d:
+                dispatch();
+            vm_case(get_d):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     double in;
 
                     if (!get_double(in)) {
-                        runtime_error("invalid number input", offset);
+                        runtime_error("invalid number input", inst->offset);
                         return false;
                     }
 
                     globals2[index] = in;
                 }
-                break;
-            case local_get_c:
+                dispatch();
+            vm_case(local_get_c):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     *(bp + index) = as_t<char>(std::getchar());
                 }
-                break;
-            case local_get_i:
+                dispatch();
+            vm_case(local_get_i):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     i64_t in;
                     if (!get_integer(in)) {
-                        runtime_error("invalid integer input", offset);
+                        runtime_error("invalid integer input", inst->offset);
                         return false; 
                     }
                     *(bp + index) = in;
                 }
-                break;
-            case local_get_d:
+                dispatch();
+            vm_case(local_get_d):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     double in;
                     if (!get_double(in)) {
-                        runtime_error("invalid number input", offset);
+                        runtime_error("invalid number input", inst->offset);
                         return false;
                     }
                     *(bp + index) = in;
                 }
-                break;
-            case local_get_s:
+                dispatch();
+            vm_case(local_get_s):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    auto count = *ip++;
+                    auto index = inst->operand;
+                    auto count = inst->count;
                     i32_t i = 0;
                     char c;
                     while (!std::isspace((c = std::getchar())) && c != std::char_traits<char>::eof() && i < count - 1) {
@@ -4031,118 +7846,106 @@ runtime_start:
                         }
                     }
                 }
-                break;
-            case local_get_c_ref:
+                dispatch();
+            vm_case(local_get_c_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     *(bp + index - (bp + index)->as_int()) = as_t<char>(std::getchar());
                 }
-                break;
-            case local_get_i_ref:
+                dispatch();
+            vm_case(local_get_i_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     i64_t in;
                     if (!get_integer(in)) {
-                        runtime_error("invalid integer input", offset);
+                        runtime_error("invalid integer input", inst->offset);
                         return false; 
                     }
                     *(bp + index - (bp + index)->as_int()) = in;
                 }
-                break;
-            case local_get_d_ref:
+                dispatch();
+            vm_case(local_get_d_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     double in;
                     if (!get_double(in)) {
-                        runtime_error("invalid number input", offset);
+                        runtime_error("invalid number input", inst->offset);
                         return false;
                     }
                     *(bp + index - (bp + index)->as_int()) = in;
                 }
-                break;
-            case define_global:
+                dispatch();
+            vm_case(define_global):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     globals2[index] = pop();
                 }
-                break;
-            case define_local:
+                dispatch();
+            vm_case(define_local):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                 }
-                break;
-            case define_local_array:
+                dispatch();
+            vm_case(define_local_array):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    auto count = *ip++;
+                    auto index = inst->operand;
+                    auto count = inst->count;
                 }
-                break;
-            case get_global:
+                dispatch();
+            vm_case(get_global):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     push(globals2[index]);
                 }
-                break;
-            case get_local:
+                dispatch();
+            vm_target(get_local):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     push(*(bp + index));
                 }
-                break;
-            case get_local_array:
+                dispatch();
+            vm_case(get_local_array):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek().is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
 
                     auto array_index = pop().as_int();
                     if (array_index >= count) {
-                        runtime_error("out of range index", offset);
+                        runtime_error("out of range index", inst->offset);
                         return false;
                     }
 
                     push(*(bp + index + array_index));
                 }
-                break;
-            case set_global:
+                dispatch();
+            vm_case(set_global):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     globals2[index] = peek();
                 }
-                break;
-            case set_local:
+                dispatch();
+            vm_case(set_local):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     *(bp + index) = peek();
                 }
-                break;
-            case set_local_array:
+                dispatch();
+            vm_case(set_local_array):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek(1).is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
 
                     auto array_index = peek(1).as_int();
                     if (array_index >= count) {
-                        runtime_error("out of range index", offset);
+                        runtime_error("out of range index", inst->offset);
                         return false;
                     }
 
@@ -4151,107 +7954,94 @@ runtime_start:
                     pop();
                     push(val);
                 }
-                break;
-            case load_local_ref:
+                dispatch();
+            vm_case(load_local_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     push(as_t<i64_t>(index));
                 }
-                break;
-            case get_local_ref:
+                dispatch();
+            vm_case(get_local_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     push(*(bp - (bp + index)->as_int() + index));
                 }
-                break;
-            case set_local_ref:
+                dispatch();
+            vm_case(set_local_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     *(bp + index - (bp + index)->as_int()) = peek();
                 }
-                break;
-            case store_ret_value:
-                function_return_value = pop();
-                break;
-            case load_ret_value:
-                push(function_return_value);
-                break;
-            case local_array_get_c:
+                dispatch();
+            vm_case(local_array_get_c):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek().is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
 
                     auto array_index = pop().as_int();
                     if (array_index >= count) {
-                        runtime_error("out of range index", offset);
+                        runtime_error("out of range index", inst->offset);
                         return false;
                     }
 
                     char val;
                     *(bp + index + array_index) = val = as_t<char>(std::getchar());
                 }
-                break;
-            case local_array_get_i:
+                dispatch();
+            vm_case(local_array_get_i):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek().is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
 
                     auto array_index = pop().as_int();
                     if (array_index >= count) {
-                        runtime_error("out of range index", offset);
+                        runtime_error("out of range index", inst->offset);
                         return false;
                     }
 
                     i64_t val;
                     if (!get_integer(val)) {
-                        runtime_error("invalid integer input", offset);
+                        runtime_error("invalid integer input", inst->offset);
                         return false; 
                     }
                     *(bp + index + array_index) = val;
                 }
-                break;
-            case local_array_get_d:
+                dispatch();
+            vm_case(local_array_get_d):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek().is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
 
                     auto array_index = pop().as_int();
                     if (array_index >= count) {
-                        runtime_error("out of range index", offset);
+                        runtime_error("out of range index", inst->offset);
                         return false;
                     }
 
                     double val;
                     if (!get_double(val)) {
-                        runtime_error("invalid number input", offset);
+                        runtime_error("invalid number input", inst->offset);
                         return false;
                     }
                     *(bp + index + array_index) = val;
                 }
-                break;
-            case set_string:
+                dispatch();
+            vm_case(set_string):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     auto str = peek().as_string();
                     #ifdef min // in wndows api, there is a min macro defined, so I undefied it to surpass errors
                     #undef min
@@ -4266,19 +8056,18 @@ runtime_start:
                         ++size;
                     }
                 }
-                break;
-            case set_string_index:
+                dispatch();
+            vm_case(set_string_index):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek().is_char()) {
-                        runtime_error("only <character> can be assigned to string", offset);
+                        runtime_error("only <character> can be assigned to string", inst->offset);
                         return false;
                     }
 
                     if (!peek(1).is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
                     auto val = pop().as_char();
@@ -4286,16 +8075,15 @@ runtime_start:
                     *(bp + index + string_index) = val;
                     push(val);
                 }
-                break;
-            case get_string:
+                dispatch();
+            vm_case(get_string):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    auto count = *ip++;
+                    auto index = inst->operand;
+                    auto count = inst->count;
                     temp_length = 0;
                     for (i32_t i = 0; i < count - 1; ++i) {
                         if (!(bp + index + i)->is_char()) {
-                            runtime_error("string has data other than <characters>", offset);
+                            runtime_error("string has data other than <characters>", inst->offset);
                             return false;
                         }
 
@@ -4306,68 +8094,65 @@ runtime_start:
                     temp[temp_length] = '\0';
                     push(StringLiteral{temp, temp_length});
                 }
-                break;
-            case load_array_ref:
+                dispatch();
+            vm_case(load_array_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    push(as_t<i64_t>((bp + index) - stack.begin()));
+                    auto index = inst->operand;
+                    push(as_t<i64_t>((bp + index) - stack.data()));
                     /*push(as_t<i64_t>(index));*/
                 }
-                break;
-            case load_arg_array_ref:
+                dispatch();
+            vm_case(load_arg_array_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
+                    auto index = inst->operand;
                     push((bp + index)->as_int());
                 }
-                break;
-            case get_array_ref:
+                dispatch();
+            vm_case(get_array_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek().is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
 
                     auto array_index = pop().as_int();
                     if (array_index >= count) {
-                        runtime_error("out of range index", offset);
+                        runtime_error("out of range index", inst->offset);
                         return false;
                     }
-                    push(*(stack.begin() + (bp + index)->as_int() + array_index));
+                    push(*(stack.data() + (bp + index)->as_int() + array_index));
                     /*push(*(bp + index - (*(bp + index)).as_int() + array_index));*/
                 }
-                break;
-            case set_array_ref:
+                dispatch();
+            vm_case(set_array_ref):
                 {
-                    auto index = get_double_byte_index(ip - code.begin());
-                    ip += 2;
-                    u8_t count = *ip++;
+                    auto index = inst->operand;
+                    u8_t count = inst->count;
                     if (!peek(1).is_int()) {
-                        runtime_error("index of array have to be of type <integer>", offset);
+                        runtime_error("index of array have to be of type <integer>", inst->offset);
                         return false;
                     }
 
                     auto array_index = peek(1).as_int();
                     if (array_index >= count) {
-                        runtime_error("out of range index", offset);
+                        runtime_error("out of range index", inst->offset);
                         return false;
                     }
 
                     auto val = pop();
-                    *(stack.begin() + (bp + index)->as_int() + array_index) = val;
+                    *(stack.data() + (bp + index)->as_int() + array_index) = val;
                     /**(bp + index - (*(bp + index)).as_int() + array_index) = val;*/
                     pop();
                     push(val);
                 }
-                break;
-            case cast_to_int:
+                dispatch();
+            vm_case(cast_to_int):
                 {
-                    if (peek().is_int())
-                        break;
+                    if (peek().is_int()) {
+                        dispatch();
+                    }
                     auto val = pop();
                     if (val.is_bool()) {
                         push(as_t<i64_t>(val.as_bool() ? 1 : 0));
@@ -4378,15 +8163,16 @@ runtime_start:
                     } else if (val.is_nil()) {
                         push(as_t<i64_t>(0));
                     } else {
-                        runtime_error("invalid conveersion to <integer>, types are not compatible", offset);
+                        runtime_error("invalid conveersion to <integer>, types are not compatible", inst->offset);
                         return false;
                     }
                 }
-                break;
-            case cast_to_double:
+                dispatch();
+            vm_case(cast_to_double):
                 {
-                    if (peek().is_double())
-                        break;
+                    if (peek().is_double()) {
+                        dispatch();
+                    }
                     auto val = pop();
                     if (val.is_int()) {
                         push(as_t<double>(val.as_int()));
@@ -4397,15 +8183,16 @@ runtime_start:
                     } else if (val.is_nil()) {
                         push(0.0);
                     } else {
-                        runtime_error("invalid conversion to <double>, types are not compatible", offset);
+                        runtime_error("invalid conversion to <double>, types are not compatible", inst->offset);
                         return false;
                     }
                 }
-                break;
-            case cast_to_char:
+                dispatch();
+            vm_case(cast_to_char):
                 {
-                    if (peek().is_char())
-                        break;
+                    if (peek().is_char()) {
+                        dispatch();
+                    }
                     auto val = pop();
                     if (val.is_int()) {
                         push(as_t<char>(val.as_int()));
@@ -4414,62 +8201,329 @@ runtime_start:
                     } else if (val.is_nil()) {
                         push('\0');
                     } else {
-                        runtime_error("invalid conversion to <character>, types are not compatible", offset);
+                        runtime_error("invalid conversion to <character>, types are not compatible", inst->offset);
                         return false;
                     }
                 }
-                break;
-            case cast_to_bool:
+                dispatch();
+            vm_case(cast_to_bool):
                 {
-                    if (peek().is_bool())
-                        break;
+                    if (peek().is_bool()) {
+                        dispatch();
+                    }
                     auto val = pop();
                     push(val.as_bool());
                 }
-                break;
-            case ret:
+                dispatch();
+            vm_case(add_int_int):
+                quickened_operation(add, is_small_int, as_small_int, +);
+                dispatch();
+            vm_case(sub_int_int):
+                quickened_operation(sub, is_small_int, as_small_int, -);
+                dispatch();
+            vm_case(mult_int_int):
+                quickened_operation(mult, is_small_int, as_small_int, *);
+                dispatch();
+            vm_case(idiv_int_int):
+                quickened_operation(idiv, is_small_int, as_small_int, /);
+                dispatch();
+            vm_case(mod_int_int):
+                quickened_operation(mod, is_small_int, as_small_int, %);
+                dispatch();
+            vm_case(lt_int_int):
+                quickened_operation(lt, is_small_int, as_small_int, <);
+                dispatch();
+            vm_case(lte_int_int):
+                quickened_operation(lte, is_small_int, as_small_int, <=);
+                dispatch();
+            vm_case(gt_int_int):
+                quickened_operation(gt, is_small_int, as_small_int, >);
+                dispatch();
+            vm_case(gte_int_int):
+                quickened_operation(gte, is_small_int, as_small_int, >=);
+                dispatch();
+            vm_case(eq_int_int):
+                quickened_operation(eq, is_small_int, as_small_int, ==);
+                dispatch();
+            vm_case(neq_int_int):
+                quickened_operation(neq, is_small_int, as_small_int, !=);
+                dispatch();
+            vm_case(add_double_double):
+                quickened_operation(add, is_double, as_double, +);
+                dispatch();
+            vm_case(sub_double_double):
+                quickened_operation(sub, is_double, as_double, -);
+                dispatch();
+            vm_case(mult_double_double):
+                quickened_operation(mult, is_double, as_double, *);
+                dispatch();
+            vm_case(idiv_double_double):
+                quickened_operation(idiv, is_double, as_double, /);
+                dispatch();
+            vm_case(lt_double_double):
+                quickened_operation(lt, is_double, as_double, <);
+                dispatch();
+            vm_case(lte_double_double):
+                quickened_operation(lte, is_double, as_double, <=);
+                dispatch();
+            vm_case(gt_double_double):
+                quickened_operation(gt, is_double, as_double, >);
+                dispatch();
+            vm_case(gte_double_double):
+                quickened_operation(gte, is_double, as_double, >=);
+                dispatch();
+            vm_case(jif_local_lt_const):
+                fused_jif(Value(as_t<i64_t>(inst[1].operand)), <);
+                dispatch();
+            vm_case(jif_local_lte_const):
+                fused_jif(Value(as_t<i64_t>(inst[1].operand)), <=);
+                dispatch();
+            vm_case(jif_local_gt_const):
+                fused_jif(Value(as_t<i64_t>(inst[1].operand)), >);
+                dispatch();
+            vm_case(jif_local_gte_const):
+                fused_jif(Value(as_t<i64_t>(inst[1].operand)), >=);
+                dispatch();
+            vm_case(jif_local_lt_local):
+                fused_jif(*(bp + inst[1].operand), <);
+                dispatch();
+            vm_case(jif_local_lte_local):
+                fused_jif(*(bp + inst[1].operand), <=);
+                dispatch();
+            vm_case(jif_local_gt_local):
+                fused_jif(*(bp + inst[1].operand), >);
+                dispatch();
+            vm_case(jif_local_gte_local):
+                fused_jif(*(bp + inst[1].operand), >=);
+                dispatch();
+            vm_case(add_local_const):
+                fused_add(Value(as_t<i64_t>(inst[1].operand)));
+                dispatch();
+            vm_case(add_local_local):
+                fused_add(*(bp + inst[1].operand));
+                dispatch();
+            vm_case(inc_local_discard):
                 {
-                    auto ret_addr = pop().as_int();
-                    ip = code.begin() + ret_addr;
+                    auto &val = *(bp + inst->operand);
+                    if (!val.is_small_int()) {
+                        unfuse(pre_inc_local);
+                    }
+                    val = val.as_small_int() + 1;
+                    ip = inst + 2;
                 }
-                break;
-            case main_ret:
+                dispatch();
+            vm_case(dec_local_discard):
+                {
+                    auto &val = *(bp + inst->operand);
+                    if (!val.is_small_int()) {
+                        unfuse(pre_dec_local);
+                    }
+                    val = val.as_small_int() - 1;
+                    ip = inst + 2;
+                }
+                dispatch();
+            vm_case(pop_jump):
+                pop();
+                ip = program.begin() + inst[1].operand;
+                dispatch();
+            vm_case(jit_call):
+                if (!jit_run(*inst))
+                    return false;
+                dispatch();
+            vm_case(move_r):
+                *(bp + inst->operand) = register_operand(1);
+                dispatch();
+            vm_case(add_r):
+                register_operation(+);
+                dispatch();
+            vm_case(sub_r):
+                register_operation(-);
+                dispatch();
+            vm_case(mult_r):
+                register_operation(*);
+                dispatch();
+            vm_case(idiv_r):
+                register_operation(/);
+                dispatch();
+            vm_case(mod_r):
+                register_operation(%);
+                dispatch();
+            vm_case(lt_r):
+                register_operation(<);
+                dispatch();
+            vm_case(lte_r):
+                register_operation(<=);
+                dispatch();
+            vm_case(gt_r):
+                register_operation(>);
+                dispatch();
+            vm_case(gte_r):
+                register_operation(>=);
+                dispatch();
+            vm_case(eq_r):
+                register_operation(==);
+                dispatch();
+            vm_case(neq_r):
+                register_operation(!=);
+                dispatch();
+            vm_case(jit_r):
+                if (register_operand(1).as_bool())
+                    ip = program.begin() + inst->operand;
+                dispatch();
+            vm_case(jif_r):
+                if (!register_operand(1).as_bool())
+                    ip = program.begin() + inst->operand;
+                dispatch();
+            vm_case(inc_r):
+                {
+                    auto &val = *(bp + inst->operand);
+                    if (val.is_int()) {
+                        val = val.as_int() + 1;
+                    } else if (val.is_double()) {
+                        val = val.as_double() + 1.0;
+                    } else {
+                        runtime_error("'++' operator expectd operand of type <integer> or <double>", inst->offset);
+                        return false;
+                    }
+                }
+                dispatch();
+            vm_case(dec_r):
+                {
+                    auto &val = *(bp + inst->operand);
+                    if (val.is_int()) {
+                        val = val.as_int() - 1;
+                    } else if (val.is_double()) {
+                        val = val.as_double() - 1.0;
+                    } else {
+                        runtime_error("'--' operator expectd operand of type <integer> or <double>", inst->offset);
+                        return false;
+                    }
+                }
+                dispatch();
+            vm_case(call_r):
+                sp = bp + inst->src1;
+                push_frame(*inst);
+                dispatch();
+            vm_case(ret_r):
+                pop_frame(register_operand(1));
+                dispatch();
+            vm_case(set_sp):
+                sp = bp + inst->operand;
+                dispatch();
+            vm_case(ret):
+                pop_frame(pop());
+                dispatch();
+            vm_case(main_ret):
                 return true;
             default:
+#if NCC_THREADED_DISPATCH
+label_unhandled:
+#endif
                 return true;
         }
 
-        if (has_globals) {
-            goto global_execution;
-        }
-
+        if (single_step)
+            return true;
     }
 
+#undef vm_case
+#undef vm_target
+#undef dispatch
+#undef unfuse
+#undef fused_jif
+#undef fused_add
+#undef register_operand
+#undef register_operation
     return true;
 }
 
+VM::VM(Compiler &compiler)
+    : compiler(compiler), code(compiler.code), values(compiler.values), lines(compiler.lines),
+      globals2(compiler.globals2), functions(compiler.functions),
+      global_codes(compiler.global_codes), main_addr(compiler.main_addr)
+{
+#if NCC_NAN_BOXING
+    int_heap.roots = {&stack, &values, &globals2.vals};
+#endif
+}
 
-bool interpret() {
-    auto start = std::chrono::system_clock::now();
-    if (!compile()) {
+VM::~VM() {
+#if NCC_NAN_BOXING
+    int_heap.roots.clear();
+#endif
+#if NCC_JIT
+    if (jit_code)
+        munmap(jit_code, jit_code_size);
+#endif
+}
+
+bool VM::run_vm() {
+    /* every global initializer is a single instruction */
+    for (auto global: global_codes) {
+        ip = program.begin() + program_index(global);
+        if (!execute(true))
+            return false;
+    }
+
+    ip = program.begin() + program_index(main_addr);
+    return execute(false);
+}
+
+
+/* compiles and runs one script with a compiler and a vm of its own, so
+ * any number of scripts can run one after the other */
+bool interpret(char const *file) {
+    Compiler compiler;
+    if (!compiler.read_file(file))
         return false;
+
+    auto start = std::chrono::system_clock::now();
+    /* -d wants the listing of the compiler, so it always compiles */
+    bool cached = use_cache && !show_opcodes && compiler.load_cache(file);
+    if (!cached) {
+        if (!compiler.compile()) {
+            return false;
+        }
+        if (use_cache && compiler.main_addr != -1)
+            compiler.save_cache(file);
     }
     auto end = std::chrono::system_clock::now();
     std::cout << "compile time: " << std::chrono::duration_cast<std::chrono::seconds>(end - start).count() << "s\n";
    
 
-    if (main_addr == -1) {
+    if (compiler.main_addr == -1) {
         std::fprintf(stderr, "ncc:" BOLD_RED "error" NORMAL ": could not find main function\n");
         return false;
     }
 
-    ip = code.begin() + main_addr;
+    VM vm(compiler);
+    vm.decode();
+    if (inline_threshold > 0)
+        vm.inline_calls();
+    if (NCC_REGISTER_VM)
+        vm.registerize();
+    /* the jit steps single instructions of the functions it compiled, those
+     * have to stay as they are. the mined counts are of the plain ones */
+    if (use_jit)
+        vm.jit_compile();
+    else if (!NCC_REGISTER_VM && use_superinstructions && !count_ngrams)
+        vm.fuse();
+    if (count_ngrams)
+        vm.ngram_runs.assign(vm.program.size(), {});
     if (show_opcodes) {
         std::fprintf(stderr, "main function starts at:\n");
-        disassemble_instruction(main_addr);
+        compiler.disassemble_instruction(compiler.main_addr);
     }
     /*return true;*/
-    return run_vm();
+    auto ok = vm.run_vm();
+    if (count_ngrams)
+        vm.print_ngrams();
+    return ok;
+}
+
+bool is_nc_file(char const *arg) {
+    auto len = std::strlen(arg);
+    return len >= 4 && arg[len-1] == 'c' && arg[len-2] == 'n' && arg[len-3] == '.';
 }
 
 /* runtime end */
@@ -4481,18 +8535,29 @@ int main(int argc, char **argv) {
     setupConsole();
 #endif
 
+    vector<char const *> files;
     if (argc > 1) {
-        auto len = std::strlen(argv[1]);
-        if (len >= 4 && argv[1][len-1] == 'c' && argv[1][len-2] == 'n' && argv[1][len-3] == '.') {
-            if (!read_file(argv[1])) {
-                return EXIT_FAILURE;
-            }
-            save_all_lines();
-
-            if (argc > 2) {
-                if (std::strlen(argv[2]) == 2 && std::strncmp(argv[2], "-d", 2) == 0)
+        if (is_nc_file(argv[1])) {
+            files.push_back(argv[1]);
+            for (i32_t i = 2; i < argc; ++i) {
+                if (is_nc_file(argv[i]))
+                    files.push_back(argv[i]);
+                else if (std::strcmp(argv[i], "-d") == 0)
                     show_opcodes = true;
+                else if (std::strcmp(argv[i], "--jit") == 0)
+                    use_jit = true;
+                else if (std::strcmp(argv[i], "--ngrams") == 0)
+                    count_ngrams = true;
+                else if (std::strcmp(argv[i], "--no-fuse") == 0)
+                    use_superinstructions = false;
+                else if (std::strcmp(argv[i], "--no-cache") == 0)
+                    use_cache = false;
+                else if (std::strcmp(argv[i], "--inline-threshold") == 0 && i + 1 < argc)
+                    inline_threshold = std::atoi(argv[++i]);
             }
+
+            if (use_jit && !NCC_JIT)
+                std::fprintf(stderr, "ncc: " BOLD_PURBLE "warning" NORMAL ": --jit is not supported by this build, running the interpreter\n");
         } else {
             std::fprintf(stderr, "ncc: " BOLD_RED "error" NORMAL ": unknown file format. Only files with extension 'nc' are supported\n");
 
@@ -4505,7 +8570,7 @@ int main(int argc, char **argv) {
             return EXIT_FAILURE;
         }
     } else {
-        std::fprintf(stderr, "usage: ncc FILE\n");
+        std::fprintf(stderr, "usage: ncc FILE... [-d] [--jit] [--ngrams] [--no-fuse] [--no-cache] [--inline-threshold N]\n");
 #ifdef __linux
             // do nothing
 #else
@@ -4514,8 +8579,12 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    if (interpret()) {
-        delete[] source;
+    /* a script that fails does not keep the ones after it from running */
+    bool ok = true;
+    for (auto file: files)
+        ok = interpret(file) && ok;
+
+    if (ok) {
 #ifdef __linux
             // do nothing
 #else
@@ -4524,7 +8593,6 @@ int main(int argc, char **argv) {
         return EXIT_SUCCESS;
     }
 
-    delete[] source;
 #ifdef __linux
             // do nothing
 #else
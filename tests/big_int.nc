@@ -0,0 +1,42 @@
+// integers keep all 64 bits in every build, including under nan boxing
+
+var first = 140737488355328 * 3;
+
+func add(a, b) {
+    return a + b;
+}
+
+func mult(a, b) {
+    return a * b;
+}
+
+// makes more big integers than the nan boxing heap holds at first, while
+// older ones are still in a global, a local and an array
+func churn(n, &a[4]) {
+    var kept = first + 1;
+    var s = 0;
+    for (var i = 0; i < n; ++i) {
+        s = s + 1000000000000 + i;
+        a[i % 4] = s;
+    }
+    return kept + s;
+}
+
+func main() {
+    var max = 9223372036854775807;
+    var edge = 140737488355327;
+    print("{max} {max - 1} {max / 2}\n");
+    print("{edge + 1} {add(edge, 1)} {0 - edge - 2}\n");
+    print("{mult(400000000, 400000000)} {400000000 * 400000000}\n");
+    print("{add(edge, 1) == edge + 1} {add(edge, 1) != edge + 2} {add(edge, 1) > edge}\n");
+
+    var s = 0;
+    for (var i = 0; i < 1000; i = i + 1) {
+        s = s + i * 1000000000000;
+    }
+    print("{s} {s / 1000000000000}\n");
+
+    var a[4];
+    var r = churn(100000, &a);
+    print("{first} {r} {a[0]} {a[3]} {a[0] - a[3]}\n");
+}
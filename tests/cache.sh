@@ -0,0 +1,39 @@
+#!/bin/sh
+# Writes the cache of every tests/*.nc script, breaks the code in it and
+# runs the script again. ncc has to notice the broken cache and compile the
+# script again, so it still prints tests/NAME.out.
+#
+# usage: tests/cache.sh NCC [NCC FLAGS...]
+
+if [ $# -lt 1 ]; then
+    echo "usage: tests/cache.sh NCC [NCC FLAGS...]" >&2
+    exit 2
+fi
+
+NCC=$1
+shift
+DIR=$(cd "$(dirname "$0")" && pwd)
+TEMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TEMP"' EXIT
+
+# the code starts right after the 64 byte header, 0xff is no opcode
+HEADER_SIZE=64
+
+failed=0
+for script in "$DIR"/*.nc; do
+    [ -e "$script" ] || continue
+    name=$(basename "$script" .nc)
+    cp "$script" "$TEMP/$name.nc"
+    "$NCC" "$TEMP/$name.nc" "$@" > /dev/null 2>&1
+    if [ ! -e "$TEMP/$name.ncb" ]; then
+        echo "FAIL $name (no cache written)"
+        failed=1
+        continue
+    fi
+    printf '\377\377\377\377\377\377\377\377' | dd of="$TEMP/$name.ncb" bs=1 seek=$HEADER_SIZE conv=notrunc 2> /dev/null
+    if ! "$NCC" "$TEMP/$name.nc" "$@" 2>&1 | grep -v '^compile time: ' | diff -u "$DIR/$name.out" - > /dev/null; then
+        echo "FAIL $name (broken cache)${*:+ ($*)}"
+        failed=1
+    fi
+done
+exit $failed
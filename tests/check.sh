@@ -0,0 +1,27 @@
+#!/bin/sh
+# Runs every tests/*.nc script with the given ncc and compares what it
+# prints with tests/NAME.out. Every build has to print the same, so the
+# same .out files check all of them.
+#
+# usage: tests/check.sh NCC [NCC FLAGS...]
+
+if [ $# -lt 1 ]; then
+    echo "usage: tests/check.sh NCC [NCC FLAGS...]" >&2
+    exit 2
+fi
+
+NCC=$1
+shift
+DIR=$(cd "$(dirname "$0")" && pwd)
+
+failed=0
+for script in "$DIR"/*.nc; do
+    [ -e "$script" ] || continue
+    name=$(basename "$script" .nc)
+    # the compile time line is not part of the program's output
+    if ! "$NCC" "$script" --no-cache "$@" 2>&1 | grep -v '^compile time: ' | diff -u "$DIR/$name.out" - > /dev/null; then
+        echo "FAIL $name${*:+ ($*)}"
+        failed=1
+    fi
+done
+exit $failed
@@ -0,0 +1,38 @@
+// locals that start out as a constant are only replaced by it when the
+// rest of their block never writes them
+
+func main() {
+    var a = 1;
+    var b = 2;
+    var c = 3;
+    var d = 4;
+    var e = 5;
+    var f = 6;
+    var g = 7;
+    var kept = 8;
+
+    a = 10;
+    ++b;
+    while (c < 5) {
+        c = c + 1;
+    }
+    {
+        d = 40;
+        {
+            var e = 50;
+            print("inner e {e}\n");
+        }
+    }
+    print("{f = 60}\n");
+    if (kept > 0) {
+        g = 70;
+    }
+
+    var sum = 0;
+    for (var i = 0; i < 3; ++i) {
+        var step = 2;
+        sum = sum + step;
+    }
+
+    print("{a} {b} {c} {d} {e} {f} {g} {kept} {sum}\n");
+}
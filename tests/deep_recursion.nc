@@ -0,0 +1,15 @@
+// recursion far deeper than compiled code may use the native stack for,
+// the calls past that are run by the interpreter under --jit
+
+func sum(n) {
+    if (n == 0) {
+        return 0;
+    }
+    return n + sum(n - 1);
+}
+
+func main() {
+    print("{sum(1000000)}\n");
+    print("{sum(10)}\n");
+    return 0;
+}
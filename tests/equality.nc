@@ -0,0 +1,44 @@
+// == and != give the same in every build, for every kind of value
+
+func same(a, b) {
+    return a == b;
+}
+
+func differ(a, b) {
+    return a != b;
+}
+
+func main() {
+    var s = "abc";
+    var t = "abc";
+    var u = "abd";
+    var v = "ab";
+    var n = nil;
+    var i = 3;
+    var d = 2.5;
+    var c = 'x';
+    var b = true;
+
+    print("{same(s, t)} {same(s, u)} {same(s, v)} {differ(s, t)} {differ(s, u)}\n");
+    print("{same(n, nil)} {differ(n, nil)}\n");
+    print("{same(i, 3)} {same(i, 4)} {differ(i, 4)}\n");
+    print("{same(d, 2.5)} {same(d, 2.0)} {differ(d, 2.0)}\n");
+    print("{same(c, 'x')} {same(c, 'y')} {differ(c, 'y')}\n");
+    print("{same(b, true)} {same(b, false)} {differ(b, false)}\n");
+
+    var r1 = s == t;
+    var r2 = s != u;
+    var r3 = n == nil;
+    var r4 = "abc" == "abc";
+    var r5 = nil != nil;
+    print("{r1} {r2} {r3} {r4} {r5}\n");
+
+    if (s == t) {
+        print("strings equal\n");
+    }
+    if (n != nil) {
+        print("never\n");
+    } else {
+        print("nil is nil\n");
+    }
+}
@@ -0,0 +1,29 @@
+// the value an inlined function returns lands in the slot of its first
+// argument, reads after that have to see the result and not the argument
+
+func f2(x0, x1, x2) {
+    return ((x2 + x1) * x2);
+}
+
+func sum(a, b) {
+    return a + b;
+}
+
+func main() {
+    var m0 = 4 + f2(2, 0, 6);
+    print("{m0}\n");
+
+    var m1 = f2(1, 2, 3) - f2(3, 2, 1);
+    print("{m1}\n");
+
+    var m2 = sum(sum(1, 2), sum(3, 4)) * 2;
+    print("{m2}\n");
+
+    var i = 0;
+    var total = 0;
+    while (i < 5) {
+        total = total + sum(i, f2(0, i, 2));
+        i = i + 1;
+    }
+    print("{total}\n");
+}
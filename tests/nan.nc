@@ -0,0 +1,10 @@
+// a nan prints with its sign, with or without nan boxing
+
+func main() {
+    var z = 0.0;
+    var n = z / z;
+    var p = 0.0 - n;
+    var inf = 1.0 / z;
+    print("{n} {p} {inf} {0.0 - inf}\n");
+    print("{n == n} {n != n} {inf > 1.0}\n");
+}
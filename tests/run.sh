@@ -0,0 +1,53 @@
+#!/bin/sh
+# Builds ncc once for every configuration below and runs tests/check.sh
+# with it, once as it is and once without inlining, then tests/cache.sh.
+#
+# usage: tests/run.sh
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$ROOT/_test_build}
+
+# name:cmake flags[:ncc flags] (flags are separated by ',')
+CONFIGS="
+switch:-DNCC_THREADED_DISPATCH=OFF
+threaded:-DNCC_THREADED_DISPATCH=ON
+unfused:-DNCC_THREADED_DISPATCH=ON:--no-fuse
+nanbox:-DNCC_THREADED_DISPATCH=ON,-DNCC_NAN_BOXING=ON
+jit:-DNCC_THREADED_DISPATCH=ON:--jit
+register:-DNCC_THREADED_DISPATCH=ON,-DNCC_REGISTER_VM=ON
+"
+
+cmake_flags() {
+    rest=${1#*:}
+    echo "${rest%%:*}" | tr ',' ' '
+}
+
+ncc_flags() {
+    rest=${1#*:}
+    case $rest in
+        *:*) echo "${rest#*:}" | tr ',' ' ' ;;
+    esac
+}
+
+failed=0
+for config in $CONFIGS; do
+    name=${config%%:*}
+    flags=$(cmake_flags "$config")
+    cmake -S "$ROOT" -B "$BUILD/$name" -DCMAKE_BUILD_TYPE=Release $flags > /dev/null || exit 1
+    cmake --build "$BUILD/$name" -j > /dev/null || exit 1
+    for inline in "" "--inline-threshold 0"; do
+        if "$ROOT/tests/check.sh" "$BUILD/$name/ncc" $(ncc_flags "$config") $inline; then
+            echo "ok   $name $inline"
+        else
+            echo "FAIL $name $inline"
+            failed=1
+        fi
+    done
+    if "$ROOT/tests/cache.sh" "$BUILD/$name/ncc" $(ncc_flags "$config"); then
+        echo "ok   $name broken cache"
+    else
+        echo "FAIL $name broken cache"
+        failed=1
+    fi
+done
+exit $failed